@@ -175,7 +175,7 @@ build_common(void)
 	for (size_t i = 0; i < g.gl_pathc; i++) {
 		char *src = g.gl_pathv[i];
 		char *dst = ctoo(src);
-		if (foutdated(dst, src, "src/common/common.h")) {
+		if (foutdated(dst, src, "src/common/common.h", "src/common/qoi.h")) {
 			cmdadd(&c, CC, CFLAGS);
 			if (dflag)
 				cmdadd(&c, CFLAGS_DEBUG);
@@ -198,6 +198,7 @@ build_ewctl(void)
 	glob_t g;
 	struct strv v = {0};
 
+	pcquery(&v, "libjpeg", PKGC_CFLAGS);
 	pcquery(&v, "libjxl", PKGC_CFLAGS);
 	pcquery(&v, "libjxl_threads", PKGC_CFLAGS);
 
@@ -207,14 +208,22 @@ build_ewctl(void)
 	for (size_t i = 0; i < g.gl_pathc; i++) {
 		char *src = g.gl_pathv[i];
 		char *dst = ctoo(src);
-		if (foutdated(dst, src, "src/common/common.h")) {
+		if (foutdated(dst, src, "src/ewctl/cache.h", "src/ewctl/img.h",
+		              "src/ewctl/input.h", "src/ewctl/swizzle.h",
+		              "src/common/common.h", "src/common/qoi.h"))
+		{
 			cmdadd(&c, CC, CFLAGS);
+
+			/* libjpeg callbacks we implement don’t use all their parameters */
+			if (streq(src, "src/ewctl/jpeg.c"))
+				cmdadd(&c, "-Wno-unused-parameter");
+
 			if (dflag)
 				cmdadd(&c, CFLAGS_DEBUG);
 			else
 				cmdadd(&c, CFLAGS_RELEASE);
 			cmdaddv(&c, v.buf, v.len);
-			cmdadd(&c, "-Isrc/common", "-o", dst, "-c", src);
+			cmdadd(&c, "-pthread", "-Isrc/common", "-o", dst, "-c", src);
 			cmdprc(c);
 		}
 		free(dst);
@@ -223,6 +232,7 @@ build_ewctl(void)
 	strvfree(&v);
 	globfree(&g);
 
+	pcquery(&v, "libjpeg", PKGC_LIBS);
 	pcquery(&v, "libjxl", PKGC_LIBS);
 	pcquery(&v, "libjxl_threads", PKGC_LIBS);
 
@@ -234,7 +244,7 @@ build_ewctl(void)
 		if (!dflag)
 			cmdadd(&c, LDFLAGS_RELEASE);
 		cmdaddv(&c, v.buf, v.len);
-		cmdadd(&c, "-o", "src/ewctl/ewctl");
+		cmdadd(&c, "-pthread", "-o", "src/ewctl/ewctl");
 		cmdaddv(&c, g.gl_pathv, g.gl_pathc);
 		cmdaddv(&c, cobjs.buf, cobjs.len);
 		cmdprc(c);
@@ -266,14 +276,21 @@ build_ewd(void)
 	for (size_t i = 0; i < g.gl_pathc; i++) {
 		char *src = g.gl_pathv[i];
 		char *dst = ctoo(src);
-		if (foutdated(dst, src, "src/ewd/da.h", "src/ewd/types.h",
-		              "src/common/common.h"))
+		if (foutdated(dst, src, "src/ewd/anim.h", "src/ewd/bcache.h",
+		              "src/ewd/da.h", "src/ewd/gov.h", "src/ewd/scale.h",
+		              "src/ewd/stats.h", "src/ewd/types.h", "src/ewd/zbuf.h",
+		              "src/common/common.h", "src/common/qoi.h"))
 		{
 			cmdadd(&c, CC, CFLAGS);
 
-			/* Lots of wayland event listeners have unused parameters */
-			if (streq(src, "src/ewd/main.c"))
+			/* Lots of wayland event listeners and thread entry points have
+			   unused parameters */
+			if (streq(src, "src/ewd/main.c") || streq(src, "src/ewd/anim.c")
+			    || streq(src, "src/ewd/bcache.c")
+			    || streq(src, "src/ewd/zbuf.c"))
+			{
 				cmdadd(&c, "-Wno-unused-parameter");
+			}
 
 			if (dflag)
 				cmdadd(&c, CFLAGS_DEBUG);
@@ -281,7 +298,7 @@ build_ewd(void)
 				cmdadd(&c, CFLAGS_RELEASE);
 
 			cmdaddv(&c, v.buf, v.len);
-			cmdadd(&c, "-Isrc/common", "-o", dst, "-c", src);
+			cmdadd(&c, "-pthread", "-Isrc/common", "-o", dst, "-c", src);
 			cmdprc(c);
 		}
 		free(dst);
@@ -306,7 +323,7 @@ build_ewd(void)
 		if (!dflag)
 			cmdadd(&c, LDFLAGS_RELEASE);
 		cmdaddv(&c, v.buf, v.len);
-		cmdadd(&c, "-o", "src/ewd/ewd");
+		cmdadd(&c, "-pthread", "-o", "src/ewd/ewd");
 		cmdaddv(&c, g.gl_pathv, g.gl_pathc);
 		cmdaddv(&c, cobjs.buf, cobjs.len);
 		cmdprc(c);
@@ -28,6 +28,38 @@ void *xcalloc(size_t, size_t);
 void *xmalloc(size_t);
 void *xrealloc(void *, size_t);
 
+/* Types of messages understood by the ewd daemon; see ewd(7) */
+enum {
+	EWD_MSG_SET,
+	EWD_MSG_STATS,
+	EWD_MSG_VIEW,
+	EWD_MSG_OUTPUTS,
+	EWD_MSG_PRELOAD,
+	EWD_MSG_SHOW,
+	EWD_MSG_UNLOAD,
+	EWD_MSG_UPDATE,
+	EWD_MSG_LAYER,
+};
+
+/* Flags of set messages */
+enum {
+	EWD_SET_SPAN = 1 << 0, /* Span the image across all displays */
+};
+
+/* Placement modes of set messages */
+enum {
+	EWD_PLACE_FILL,    /* Scale to cover the display, cropping the rest */
+	EWD_PLACE_FIT,     /* Scale to fit within the display */
+	EWD_PLACE_CENTER,  /* Center without scaling */
+	EWD_PLACE_STRETCH, /* Stretch to the display, ignoring the aspect ratio */
+	EWD_PLACE_TILE,    /* Repeat without scaling */
+};
+
+/* Flags of view messages */
+enum {
+	EWD_VIEW_BOUNCE = 1 << 0, /* Move back and forth indefinitely */
+};
+
 /* Get path to the ewd socket */
 const char *ewd_sock_path(void);
 
@@ -0,0 +1,144 @@
+#include <stddef.h>
+
+#include "common.h"
+#include "qoi.h"
+
+/* Chunk tags; see https://qoiformat.org/qoi-specification.pdf */
+#define OP_INDEX 0x00
+#define OP_DIFF  0x40
+#define OP_LUMA  0x80
+#define OP_RUN   0xC0
+#define OP_RGB   0xFE
+#define OP_RGBA  0xFF
+#define OP_MASK  0xC0
+
+#define R(p) ((u8)((p) >> 16))
+#define G(p) ((u8)((p) >> 8))
+#define B(p) ((u8)(p))
+#define A(p) ((u8)((p) >> 24))
+#define PX(r, g, b, a) \
+	((xrgb)(u8)(a) << 24 | (xrgb)(u8)(r) << 16 | (xrgb)(u8)(g) << 8 | (u8)(b))
+#define HASH(p) ((R(p) * 3 + G(p) * 5 + B(p) * 7 + A(p) * 11) % 64)
+
+/* Decode the ‘len’ bytes of QOI chunks at ‘src’ (which excludes the header)
+   into ‘npx’ pixels at ‘dst’.  The alpha channel ends up in the X byte.
+   Returns false if the data runs out before all pixels were decoded. */
+bool
+qoi_decode(xrgb *restrict dst, size_t npx, const u8 *restrict src, size_t len)
+{
+	u32 run = 0;
+	size_t i = 0;
+	xrgb px = PX(0, 0, 0, 255), index[64] = {0};
+
+	for (size_t n = 0; n < npx; n++) {
+		if (run > 0) {
+			run--;
+			dst[n] = px;
+			continue;
+		}
+
+		if (i >= len)
+			return false;
+		u8 b1 = src[i];
+		size_t need = b1 == OP_RGBA             ? 5
+		            : b1 == OP_RGB              ? 4
+		            : (b1 & OP_MASK) == OP_LUMA ? 2
+		                                        : 1;
+		if (need > len - i)
+			return false;
+		i++;
+
+		if (b1 == OP_RGB) {
+			px = PX(src[i], src[i + 1], src[i + 2], A(px));
+			i += 3;
+		} else if (b1 == OP_RGBA) {
+			px = PX(src[i], src[i + 1], src[i + 2], src[i + 3]);
+			i += 4;
+		} else {
+			switch (b1 & OP_MASK) {
+			case OP_INDEX:
+				px = index[b1];
+				break;
+			case OP_DIFF:
+				px = PX(R(px) + ((b1 >> 4) & 3) - 2,
+				        G(px) + ((b1 >> 2) & 3) - 2, B(px) + (b1 & 3) - 2,
+				        A(px));
+				break;
+			case OP_LUMA: {
+				u8 b2 = src[i++];
+				int dg = (b1 & 0x3F) - 32;
+				px = PX(R(px) + dg - 8 + (b2 >> 4), G(px) + dg,
+				        B(px) + dg - 8 + (b2 & 0x0F), A(px));
+				break;
+			}
+			case OP_RUN:
+				run = b1 & 0x3F;
+				break;
+			}
+		}
+
+		index[HASH(px)] = px;
+		dst[n] = px;
+	}
+
+	return true;
+}
+
+/* Encode ‘npx’ pixels at ‘src’ as QOI chunks (without a header or padding)
+   into ‘dst’, which must have room for QOI_MAXLEN(npx) bytes.  The X byte is
+   ignored and comes back out of qoi_decode() as 0xFF, so every pixel fits in
+   at most 4 bytes.  Returns the number of bytes written. */
+size_t
+qoi_encode(u8 *restrict dst, const xrgb *restrict src, size_t npx)
+{
+	u8 *p = dst;
+	u32 run = 0;
+	xrgb px, prev = PX(0, 0, 0, 255), index[64] = {0};
+
+	for (size_t n = 0; n < npx; n++) {
+		px = src[n] | 0xFF000000;
+		if (px == prev) {
+			if (++run == 62) {
+				*p++ = OP_RUN | (run - 1);
+				run = 0;
+			}
+			continue;
+		}
+		if (run > 0) {
+			*p++ = OP_RUN | (run - 1);
+			run = 0;
+		}
+
+		u32 h = HASH(px);
+		if (index[h] == px) {
+			*p++ = OP_INDEX | h;
+			prev = px;
+			continue;
+		}
+		index[h] = px;
+
+		i8 dr = R(px) - R(prev);
+		i8 dg = G(px) - G(prev);
+		i8 db = B(px) - B(prev);
+		int dr_dg = dr - dg, db_dg = db - dg;
+
+		if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+			*p++ = OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+		else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7
+		         && db_dg >= -8 && db_dg <= 7)
+		{
+			*p++ = OP_LUMA | (dg + 32);
+			*p++ = (dr_dg + 8) << 4 | (db_dg + 8);
+		} else {
+			*p++ = OP_RGB;
+			*p++ = R(px);
+			*p++ = G(px);
+			*p++ = B(px);
+		}
+		prev = px;
+	}
+
+	if (run > 0)
+		*p++ = OP_RUN | (run - 1);
+	return p - dst;
+}
@@ -0,0 +1,19 @@
+#ifndef EXWP_QOI_H
+#define EXWP_QOI_H
+
+#include <stddef.h>
+
+#include "common.h"
+
+/* Size of the header of a QOI image, and of the padding after the last
+   chunk */
+#define QOI_HDR 14
+#define QOI_PAD 8
+
+/* Largest possible size of ‘n’ pixels encoded with qoi_encode() */
+#define QOI_MAXLEN(n) ((size_t)(n) * 4)
+
+bool qoi_decode(xrgb *restrict, size_t, const u8 *restrict, size_t);
+size_t qoi_encode(u8 *restrict, const xrgb *restrict, size_t);
+
+#endif /* !EXWP_QOI_H */
@@ -0,0 +1,298 @@
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "common.h"
+#include "img.h"
+
+/* Default size limit of the cache (MiB) */
+#define CACHE_SIZE_DEFAULT 1024
+
+#define MAGIC 0x31435745 /* ‘EWC1’ */
+
+/* A cache entry holds the pixels of all frames, so that the daemon can map
+   the file as is, followed by the frame durations and this trailer */
+struct trailer {
+	struct cache_key key;
+	u32 w, h, nframes;
+	u32 magic;
+};
+
+struct entry {
+	char *name;
+	struct timespec used;
+	off_t size;
+};
+
+static void cache_evict(void);
+static int entcmp(const void *, const void *);
+static u64 hash(const void *, size_t);
+static bool keypath(char *, const struct cache_key *);
+static bool writeall(int, const void *, size_t);
+
+static bool enabled;
+static u64 limit;
+static char dir[PATH_MAX];
+
+/* Locate (and create) the cache directory.  Caching is simply disabled if
+   anything goes wrong, as it’s not worth failing over. */
+void
+cache_init(void)
+{
+	char *s, *p;
+	int n;
+
+	if ((s = getenv("EWCTL_CACHE_SIZE")) && *s) {
+		errno = 0;
+		limit = strtoull(s, &p, 10);
+		if (errno || *p)
+			diex("Invalid cache size ‘%s’", s);
+	} else
+		limit = CACHE_SIZE_DEFAULT;
+	if (limit == 0)
+		return;
+	limit <<= 20;
+
+	if ((s = getenv("XDG_CACHE_HOME")) && *s)
+		n = snprintf(dir, sizeof(dir), "%s/ewctl", s);
+	else if ((s = getenv("HOME")) && *s)
+		n = snprintf(dir, sizeof(dir), "%s/.cache/ewctl", s);
+	else
+		return;
+	if ((size_t)n >= sizeof(dir) - 32)
+		return;
+
+	/* $XDG_CACHE_HOME itself might not exist yet either */
+	if ((p = strrchr(dir, '/'))) {
+		*p = 0;
+		mkdir(dir, 0700);
+		*p = '/';
+	}
+	if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+		warn("mkdir: %s", dir);
+		return;
+	}
+	enabled = true;
+}
+
+/* Build the key of the image decoded from ‘fd’ for a ‘tw’×‘th’ display.
+   Only regular files can be cached, since there’s no telling whether the
+   contents of a pipe have been seen before without reading them in full. */
+bool
+cache_key(struct cache_key *k, int fd, u32 tw, u32 th, bool cover)
+{
+	struct stat sb;
+
+	if (!enabled || fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode))
+		return false;
+
+	/* Keys are hashed and compared bytewise, padding and all */
+	memset(k, 0, sizeof(*k));
+	k->dev = sb.st_dev;
+	k->ino = sb.st_ino;
+	k->size = sb.st_size;
+	k->sec = sb.st_mtim.tv_sec;
+	k->nsec = sb.st_mtim.tv_nsec;
+	k->tw = tw;
+	k->th = th;
+	k->cover = cover;
+	return true;
+}
+
+/* Look up a decoded image.  On a hit the cache entry itself is handed to the
+   daemon, so no pixels are read at all. */
+bool
+cache_get(const struct cache_key *k, struct img *img)
+{
+	int fd;
+	char path[PATH_MAX];
+	size_t dlen;
+	struct stat sb;
+	struct trailer t;
+
+	if (!keypath(path, k) || (fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return false;
+
+	if (fstat(fd, &sb) == -1 || sb.st_size < (off_t)sizeof(t)
+	    || pread(fd, &t, sizeof(t), sb.st_size - sizeof(t)) != sizeof(t)
+	    || t.magic != MAGIC || memcmp(&t.key, k, sizeof(*k)) != 0 || !t.nframes)
+	{
+		goto miss;
+	}
+
+	*img = (struct img){
+		.fd = fd,
+		.w = t.w,
+		.h = t.h,
+		.nframes = t.nframes,
+		.size = (size_t)t.w * t.h * sizeof(xrgb) * t.nframes,
+	};
+	dlen = t.nframes * sizeof(*img->durs);
+	if ((u64)sb.st_size != img->size + dlen + sizeof(t))
+		goto miss;
+	img->durs = xmalloc(dlen);
+	if (pread(fd, img->durs, dlen, img->size) != (ssize_t)dlen) {
+		free(img->durs);
+		goto miss;
+	}
+
+	/* The modification time of an entry is the time it was last used */
+	futimens(fd, NULL);
+	return true;
+
+miss:
+	close(fd);
+	return false;
+}
+
+/* Store a decoded image.  It’s written to a temporary file first so that
+   nobody ever sees a partial entry. */
+void
+cache_put(const struct cache_key *k, const struct img *img)
+{
+	int fd;
+	char path[PATH_MAX], tmp[PATH_MAX + sizeof(".XXXXXX")];
+	struct trailer t = {
+		.key = *k,
+		.w = img->w,
+		.h = img->h,
+		.nframes = img->nframes,
+		.magic = MAGIC,
+	};
+
+	if (!keypath(path, k)
+	    || (size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp))
+	{
+		return;
+	}
+	if ((fd = mkostemp(tmp, O_CLOEXEC)) == -1) {
+		warn("mkostemp: %s", tmp);
+		return;
+	}
+
+	if (!writeall(fd, img->buf, img->size)
+	    || !writeall(fd, img->durs, img->nframes * sizeof(*img->durs))
+	    || !writeall(fd, &t, sizeof(t)))
+	{
+		warn("write: %s", tmp);
+		goto err;
+	}
+	if (rename(tmp, path) == -1) {
+		warn("rename: %s", tmp);
+		goto err;
+	}
+
+	close(fd);
+	cache_evict();
+	return;
+
+err:
+	unlink(tmp);
+	close(fd);
+}
+
+/* Remove the least recently used entries until the cache fits in its size
+   limit again */
+void
+cache_evict(void)
+{
+	DIR *dp;
+	u64 total = 0;
+	size_t n = 0, cap = 0;
+	struct dirent *de;
+	struct entry *es = NULL;
+
+	if (!(dp = opendir(dir)))
+		return;
+
+	while ((de = readdir(dp))) {
+		struct stat sb;
+
+		/* Skip temporary files, which are still being written */
+		if (strchr(de->d_name, '.')
+		    || fstatat(dirfd(dp), de->d_name, &sb, AT_SYMLINK_NOFOLLOW) == -1
+		    || !S_ISREG(sb.st_mode))
+		{
+			continue;
+		}
+		if (n == cap)
+			es = xrealloc(es, (cap = cap ? cap * 2 : 64) * sizeof(*es));
+		es[n++] = (struct entry){
+			.name = strdup(de->d_name),
+			.used = sb.st_mtim,
+			.size = sb.st_size,
+		};
+		total += sb.st_size;
+	}
+
+	if (total > limit) {
+		qsort(es, n, sizeof(*es), entcmp);
+		for (size_t i = 0; i < n && total > limit; i++) {
+			if (es[i].name && unlinkat(dirfd(dp), es[i].name, 0) == 0)
+				total -= es[i].size;
+		}
+	}
+
+	for (size_t i = 0; i < n; i++)
+		free(es[i].name);
+	free(es);
+	closedir(dp);
+}
+
+/* Order entries from least to most recently used */
+int
+entcmp(const void *a, const void *b)
+{
+	const struct timespec *x = &((const struct entry *)a)->used;
+	const struct timespec *y = &((const struct entry *)b)->used;
+
+	if (x->tv_sec != y->tv_sec)
+		return x->tv_sec < y->tv_sec ? -1 : 1;
+	return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/* 64-bit FNV-1a */
+u64
+hash(const void *p, size_t n)
+{
+	const u8 *s = p;
+	u64 h = 0xCBF29CE484222325;
+
+	while (n--)
+		h = (h ^ *s++) * 0x100000001B3;
+	return h;
+}
+
+/* Get the path of the cache entry of ‘k’, returning false if it doesn’t fit
+   in a path */
+bool
+keypath(char *buf, const struct cache_key *k)
+{
+	int n = snprintf(buf, PATH_MAX, "%s/%016" PRIx64, dir, hash(k, sizeof(*k)));
+	return n >= 0 && n < PATH_MAX;
+}
+
+bool
+writeall(int fd, const void *p, size_t n)
+{
+	ssize_t nw;
+
+	for (const u8 *s = p; n > 0; s += nw, n -= nw) {
+		if ((nw = write(fd, s, n)) == -1) {
+			if (errno == EINTR)
+				nw = 0;
+			else
+				return false;
+		}
+	}
+	return true;
+}
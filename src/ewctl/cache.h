@@ -0,0 +1,22 @@
+#ifndef EWCTL_CACHE_H
+#define EWCTL_CACHE_H
+
+#include "common.h"
+#include "img.h"
+
+/* Identifies a decoded image: the file it was decoded from, and the display
+   size it was decoded for (0×0 if that doesn’t matter for its format) and
+   whether it was decoded to cover that size rather than fit within it */
+struct cache_key {
+	u64 dev, ino, size;
+	i64 sec, nsec; /* Modification time */
+	u32 tw, th;
+	u32 cover;
+};
+
+void cache_init(void);
+bool cache_key(struct cache_key *, int, u32, u32, bool);
+bool cache_get(const struct cache_key *, struct img *);
+void cache_put(const struct cache_key *, const struct img *);
+
+#endif /* !EWCTL_CACHE_H */
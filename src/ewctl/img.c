@@ -0,0 +1,31 @@
+#include <sys/mman.h>
+
+#include <unistd.h>
+
+#include "common.h"
+#include "img.h"
+
+/* Create a still image of the given dimensions, backed by a memfd */
+struct img
+img_new(u32 w, u32 h)
+{
+	struct img img = {
+		.w = w,
+		.h = h,
+		.nframes = 1,
+		.durs = xcalloc(1, sizeof(u32)),
+		.size = (size_t)w * h * sizeof(xrgb),
+	};
+
+	if ((img.fd = memfd_create("ewctl-mem", 0)) == -1)
+		die("memfd_create");
+	if (ftruncate(img.fd, img.size) == -1)
+		die("ftruncate");
+	if ((img.buf = mmap(NULL, img.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                    img.fd, 0))
+	    == MAP_FAILED)
+	{
+		die("mmap");
+	}
+	return img;
+}
@@ -0,0 +1,29 @@
+#ifndef EWCTL_IMG_H
+#define EWCTL_IMG_H
+
+#include <stddef.h>
+
+#include "common.h"
+#include "input.h"
+
+/* A decoded image in XRGB format, stored in a memfd to be sent to the
+   daemon */
+struct img {
+	int fd;
+	u8 *buf;
+	u32 w, h;
+	u32 nframes; /* Number of frames; > 1 for animations */
+	u32 *durs;   /* Per-frame durations in milliseconds */
+	size_t size; /* Size of all frames together */
+};
+
+struct img img_new(u32, u32);
+
+/* Decoders of the various input formats, which take ownership of the input
+   they’re given */
+struct img ff_decode(struct input *);
+struct img jpeg_decode(struct input *, u32, u32, bool);
+struct img qoi_load(struct input *);
+struct img raw_decode(const char *, int, u32, u32);
+
+#endif /* !EWCTL_IMG_H */
@@ -0,0 +1,85 @@
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "input.h"
+
+/* Prepare to read the encoded image from ‘fd’.  Regular files are simply
+   mapped into memory in their entirety, while anything else (such as a pipe)
+   is read into a buffer as the decoder asks for more input. */
+struct input
+in_open(const char *name, int fd)
+{
+	struct stat sb;
+	struct input in = {.name = name, .fd = fd};
+
+	if (fstat(fd, &sb) == -1)
+		die("fstat: %s", name);
+
+	if (S_ISREG(sb.st_mode) && sb.st_size > 0) {
+		in.buf = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (in.buf != MAP_FAILED) {
+			in.len = sb.st_size;
+			in.mapped = in.eof = true;
+			in.hlen = MIN(in.len, sizeof(in.head));
+			memcpy(in.head, in.buf, in.hlen);
+			return in;
+		}
+		/* Some filesystems don’t support mmap(2); fall back to reading */
+	}
+
+	in.cap = MAX((size_t)sb.st_blksize, (size_t)BUFSIZ);
+	in.buf = xmalloc(in.cap);
+	return in;
+}
+
+/* Append whatever a single read(2) returns to the buffer, doubling the size
+   of the buffer first if it’s full */
+void
+in_read(struct input *in)
+{
+	ssize_t nr;
+
+	if (in->len == in->cap)
+		in->buf = xrealloc(in->buf, in->cap *= 2);
+
+	do
+		nr = read(in->fd, in->buf + in->len, in->cap - in->len);
+	while (nr == -1 && errno == EINTR);
+	if (nr == -1)
+		die("read: %s", in->name);
+	if (nr == 0)
+		in->eof = true;
+
+	if (in->hlen < sizeof(in->head)) {
+		size_t n = MIN((size_t)nr, sizeof(in->head) - in->hlen);
+		memcpy(in->head + in->hlen, in->buf + in->len, n);
+		in->hlen += n;
+	}
+	in->len += nr;
+}
+
+/* Make sure that the first ‘n’ bytes of the input are buffered (or that there
+   aren’t that many), so that the file type can be identified */
+void
+in_peek(struct input *in, size_t n)
+{
+	while (in->len < n && !in->eof)
+		in_read(in);
+}
+
+void
+in_close(struct input *in)
+{
+	if (in->mapped)
+		munmap(in->buf, in->len);
+	else
+		free(in->buf);
+}
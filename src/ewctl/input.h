@@ -0,0 +1,27 @@
+#ifndef EWCTL_INPUT_H
+#define EWCTL_INPUT_H
+
+#include <stddef.h>
+
+#include "common.h"
+
+/* Encoded input, either mapped into memory in its entirety or streamed in
+   bit by bit as the decoder asks for more */
+struct input {
+	const char *name;
+	int fd;
+	u8 *buf;
+	size_t len, cap;
+	bool mapped;  /* Is ‘buf’ a mapping of the whole file? */
+	bool eof;     /* Has all of the input been read? */
+	bool fed;     /* Has the decoder been given the buffer yet? */
+	u8 head[12];  /* Start of the input, to identify the file type */
+	size_t hlen;
+};
+
+struct input in_open(const char *, int);
+void in_close(struct input *);
+void in_peek(struct input *, size_t);
+void in_read(struct input *);
+
+#endif /* !EWCTL_INPUT_H */
@@ -0,0 +1,141 @@
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+#include "common.h"
+#include "img.h"
+#include "input.h"
+
+/* Source manager feeding the decoder straight from our input buffer */
+struct source {
+	struct jpeg_source_mgr pub;
+	struct input *in;
+};
+
+[[noreturn]] static void jpeg_die(j_common_ptr);
+static void jpeg_warn(j_common_ptr);
+static boolean src_fill(j_decompress_ptr);
+static void src_init(j_decompress_ptr);
+static void src_skip(j_decompress_ptr, long);
+static void src_term(j_decompress_ptr);
+
+/* Decode a JPEG image.  The IDCT can produce the image at any multiple of
+   an eighth of its size for much less work than decoding it in full, so we
+   pick the smallest scale that is still at least as large as the display
+   (given as ‘tw’×‘th’, or 0×0 if unknown) once fit to it, or once scaled to
+   cover it if ‘cover’ is set.  Rows are written straight into the memfd in
+   XRGB order. */
+struct img
+jpeg_decode(struct input *in, u32 tw, u32 th, bool cover)
+{
+	struct img img;
+	struct source src = {
+		.pub = {
+			.init_source = src_init,
+			.fill_input_buffer = src_fill,
+			.skip_input_data = src_skip,
+			.resync_to_restart = jpeg_resync_to_restart,
+			.term_source = src_term,
+		},
+		.in = in,
+	};
+	struct jpeg_error_mgr jerr;
+	struct jpeg_decompress_struct cinfo;
+
+	cinfo.err = jpeg_std_error(&jerr);
+	jerr.error_exit = jpeg_die;
+	jerr.output_message = jpeg_warn;
+
+	jpeg_create_decompress(&cinfo);
+	cinfo.src = &src.pub;
+	jpeg_read_header(&cinfo, TRUE);
+
+	cinfo.out_color_space = JCS_EXT_BGRX;
+	cinfo.scale_denom = 8;
+	for (cinfo.scale_num = 1; cinfo.scale_num < 8; cinfo.scale_num++) {
+		jpeg_calc_output_dimensions(&cinfo);
+		bool wide = cinfo.output_width >= tw, tall = cinfo.output_height >= th;
+		if ((tw == 0 && th == 0) || (cover ? wide && tall : wide || tall))
+			break;
+	}
+
+	jpeg_start_decompress(&cinfo);
+	img = img_new(cinfo.output_width, cinfo.output_height);
+
+	while (cinfo.output_scanline < cinfo.output_height) {
+		JSAMPROW row = img.buf
+		             + (size_t)cinfo.output_scanline * img.w * sizeof(xrgb);
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	in_close(in);
+	return img;
+}
+
+void
+jpeg_die(j_common_ptr cinfo)
+{
+	char buf[JMSG_LENGTH_MAX];
+	cinfo->err->format_message(cinfo, buf);
+	diex("Failed to decode file: %s", buf);
+}
+
+void
+jpeg_warn(j_common_ptr cinfo)
+{
+	char buf[JMSG_LENGTH_MAX];
+	cinfo->err->format_message(cinfo, buf);
+	warnx("%s", buf);
+}
+
+/* Hand the decoder whatever was read while identifying the file type, or
+   the whole file if it was mapped */
+void
+src_init(j_decompress_ptr cinfo)
+{
+	struct source *src = (struct source *)cinfo->src;
+	src->pub.next_input_byte = src->in->buf;
+	src->pub.bytes_in_buffer = src->in->len;
+}
+
+/* Called once the decoder has consumed the entire buffer, so we can simply
+   reuse it from the start */
+boolean
+src_fill(j_decompress_ptr cinfo)
+{
+	struct source *src = (struct source *)cinfo->src;
+	struct input *in = src->in;
+
+	if (in->eof)
+		diex("Input image was truncated");
+	in->len = 0;
+	in_read(in);
+	if (in->eof)
+		diex("Input image was truncated");
+
+	src->pub.next_input_byte = in->buf;
+	src->pub.bytes_in_buffer = in->len;
+	return TRUE;
+}
+
+void
+src_skip(j_decompress_ptr cinfo, long n)
+{
+	struct source *src = (struct source *)cinfo->src;
+
+	if (n <= 0)
+		return;
+	while ((size_t)n > src->pub.bytes_in_buffer) {
+		n -= src->pub.bytes_in_buffer;
+		src_fill(cinfo);
+	}
+	src->pub.next_input_byte += n;
+	src->pub.bytes_in_buffer -= n;
+}
+
+void
+src_term(j_decompress_ptr cinfo)
+{
+}
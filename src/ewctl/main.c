@@ -1,12 +1,15 @@
 #include <sys/mman.h>
+#include <sys/param.h>
 #include <sys/socket.h>
-#include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,7 +20,20 @@
 #include <jxl/thread_parallel_runner.h>
 #include <jxl/types.h>
 
+#include "cache.h"
 #include "common.h"
+#include "img.h"
+#include "input.h"
+#include "swizzle.h"
+
+/* Still images with at least this many pixels are first sent to the daemon as
+   a preview at an eighth of their resolution, while the rest of the image is
+   still being decoded */
+#define PREVIEW_MIN (8 << 20)
+
+/* Animations are decoded in full, each frame taking 4 bytes per pixel, so
+   refuse those that would take more memory than this to hold */
+#define ANIM_MAX ((size_t)2 << 30)
 
 #define warnx(...) \
 	do { \
@@ -25,32 +41,89 @@
 		rv = EXIT_FAILURE; \
 	} while (0)
 
-struct bs {
-	u8 *buf;
-	size_t size;
+/* A file to decode and the display to set it on */
+struct job {
+	char *name;
+	const char *file;
+	struct img img;
+	pthread_t thrd;
 };
 
-struct img {
-	int fd;
-	u8 *buf;
-	u32 w, h;
-	size_t size;
+struct view {
+	u32 x, y; /* Pan in permille */
+	u32 zoom; /* Zoom in percent */
+	u32 dur;  /* Duration in milliseconds */
+	u32 flags;
 };
 
+static int srv_connect(void);
 static void srv_msg(int, struct img, char *);
-static void abgr2argb(struct img);
-static struct img jxl_decode(struct bs);
-static u8 *process(const char *, int, size_t *);
+static void srv_outputs(char *, u32 *, u32 *);
+static void srv_preview(struct img, char *);
+static void srv_layer(int, struct img, char *);
+static void srv_stats(int, char *);
+static void srv_update(int, struct img, u32, u32, char *);
+static void srv_view(int, struct view, char *);
+static u32 srv_preload(int, struct img);
+static void srv_handle(int, u32, u32, char *);
+static void in_feed(JxlDecoder *, struct input *);
+static void dims_parse(const char *, u32 *, u32 *);
+static xrgb color_parse(const char *);
+static u32 id_parse(const char *);
+static void layer_parse(const char *);
+static u32 mode_parse(const char *);
+static u32 premul(u32);
+static void pos_parse(const char *, u32 *, u32 *);
+static u32 tint_parse(const char *);
+static void job_decode(struct job *, char *);
+static void *job_thrd(void *);
+static size_t jobs_parse(int, char **, char *, struct job **);
+static struct img jxl_decode(struct input *, char *);
+static void jxl_out(void *, size_t, size_t, size_t, const void *);
+static struct view view_parse(const char *);
 
 static int rv;
-static bool cflag;
+static bool aflag, bflag, cflag, lflag, mflag, pflag, rflag, sflag, Sflag;
+static bool Lflag, tflag, uflag, Uflag, vflag;
+
+/* Dimensions of raw XRGB input */
+static u32 raw_w, raw_h;
+
+/* Position on the display of the patch given to -U */
+static u32 upd_x, upd_y;
+
+/* Layer given to -L, where on the display its image goes, and the colour it
+   is filled with instead if given -t */
+static u32 lyr_id, lyr_x, lyr_y;
+static u32 tint;
+
+/* Placement mode of still images and the colour of the area they leave
+   uncovered */
+static u32 mode = EWD_PLACE_FILL;
+static xrgb bg;
+
+/* Number of worker threads in the thread pool of each JPEG XL decoder.  The
+   images of a batch are decoded concurrently, so they split the CPUs between
+   them. */
+static size_t nworkers;
 
 [[noreturn]] static void
 usage(const char *argv0)
 {
 	fprintf(stderr,
-	        "Usage: %s [-d name] [file]\n"
-	        "       %s -c | -h\n",
+	        "Usage: %s [-r WxH] [-m mode] [-l color] [-d name] [file] "
+	        "[[-d name] file ...]\n"
+	        "       %s [-r WxH] [-m mode] [-l color] -a [file]\n"
+	        "       %s [-d name] -c | -s\n"
+	        "       %s [-d name] [-b] -v x,y,zoom[,duration]\n"
+	        "       %s [-r WxH] -p file ...\n"
+	        "       %s [-d name] -S id\n"
+	        "       %s -u id\n"
+	        "       %s [-r WxH] [-d name] -U x,y file\n"
+	        "       %s [-r WxH] [-d name] -L n[,x,y] file\n"
+	        "       %s [-d name] -L n -c | -t color\n"
+	        "       %s -h\n",
+	        argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0,
 	        argv0, argv0);
 	exit(EXIT_FAILURE);
 }
@@ -60,21 +133,44 @@ main(int argc, char **argv)
 {
 	char *name = "";
 	int opt, sockfd;
-	struct bs img_e;
-	struct img img_d;
-	struct sockaddr_un saddr = {
-		.sun_family = AF_UNIX,
-	};
+	u32 id = 0;
+	size_t njobs = 0;
+	struct job *jobs = NULL;
+	struct view view;
 	struct option longopts[] = {
-		{"clear",   no_argument,       0, 'c'},
-		{"display", required_argument, 0, 'd'},
-		{"help",    no_argument,       0, 'h'},
-		{NULL,      0,                 0, 0  },
+		{"bounce",    no_argument,       0, 'b'},
+		{"clear",     no_argument,       0, 'c'},
+		{"display",   required_argument, 0, 'd'},
+		{"help",      no_argument,       0, 'h'},
+		{"layer",     required_argument, 0, 'L'},
+		{"letterbox", required_argument, 0, 'l'},
+		{"mode",      required_argument, 0, 'm'},
+		{"preload",   no_argument,       0, 'p'},
+		{"raw",       required_argument, 0, 'r'},
+		{"show",      required_argument, 0, 'S'},
+		{"span",      no_argument,       0, 'a'},
+		{"stats",     no_argument,       0, 's'},
+		{"tint",      required_argument, 0, 't'},
+		{"unload",    required_argument, 0, 'u'},
+		{"update",    required_argument, 0, 'U'},
+		{"view",      required_argument, 0, 'v'},
+		{NULL,        0,                 0, 0  },
 	};
 
 	*argv = basename(*argv);
-	while ((opt = getopt_long(argc, argv, "cd:h", longopts, NULL)) != -1) {
+	swizzle_init();
+
+	while ((opt = getopt_long(argc, argv, "+abcd:hL:l:m:pr:S:st:u:U:v:",
+	                          longopts, NULL))
+	       != -1)
+	{
 		switch (opt) {
+		case 'a':
+			aflag = true;
+			break;
+		case 'b':
+			bflag = true;
+			break;
 		case 'c':
 			cflag = true;
 			break;
@@ -84,6 +180,48 @@ main(int argc, char **argv)
 		case 'h':
 			execlp("man", "man", "1", *argv, NULL);
 			die("execlp: man 1 %s", *argv);
+		case 'L':
+			Lflag = true;
+			layer_parse(optarg);
+			break;
+		case 'l':
+			lflag = true;
+			bg = color_parse(optarg);
+			break;
+		case 'm':
+			mflag = true;
+			mode = mode_parse(optarg);
+			break;
+		case 'p':
+			pflag = true;
+			break;
+		case 'r':
+			rflag = true;
+			dims_parse(optarg, &raw_w, &raw_h);
+			break;
+		case 's':
+			sflag = true;
+			break;
+		case 'S':
+			Sflag = true;
+			id = id_parse(optarg);
+			break;
+		case 't':
+			tflag = true;
+			tint = tint_parse(optarg);
+			break;
+		case 'u':
+			uflag = true;
+			id = id_parse(optarg);
+			break;
+		case 'U':
+			Uflag = true;
+			pos_parse(optarg, &upd_x, &upd_y);
+			break;
+		case 'v':
+			vflag = true;
+			view = view_parse(optarg);
+			break;
 		default:
 			usage(*argv);
 		}
@@ -92,26 +230,249 @@ main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (cflag) {
-		if (argc == 1)
+	if (pflag + sflag + Sflag + uflag + Uflag + vflag + (cflag || Lflag) > 1
+	    || (bflag && !vflag)
+	    || (tflag && (!Lflag || cflag))
+	    || (aflag
+	        && (cflag || pflag || sflag || Sflag || uflag || Uflag || vflag
+	            || Lflag || *name || argc > 1))
+	    || ((lflag || mflag)
+	        && (cflag || pflag || sflag || Sflag || uflag || Uflag || vflag
+	            || Lflag))
+	    || ((Uflag || (Lflag && !cflag && !tflag)) && argc != 1)
+	    || (rflag && (cflag || sflag || Sflag || tflag || uflag || vflag)))
+	{
+		usage(argv[-optind]);
+	}
+
+	if (sflag || Sflag || uflag || vflag || (Lflag && (cflag || tflag))) {
+		if (argc >= 1)
+			warnx("Ignoring file argument ‘%s’", argv[0]);
+	} else if (cflag) {
+		if (argc >= 1)
 			warnx("Ignoring file argument ‘%s’", argv[0]);
 
-		img_d = (struct img){0};
+		njobs = 1;
+		jobs = xcalloc(1, sizeof(*jobs));
+		jobs[0].name = name;
+		jobs[0].img.fd = -1;
 	} else {
-		if (argc > 1)
-			usage(*argv);
-		if (argc == 0 || streq(argv[0], "-"))
-			img_e.buf = process("-", STDIN_FILENO, &img_e.size);
+		njobs = jobs_parse(argc, argv, name, &jobs);
+		cache_init();
+		nworkers = JxlThreadParallelRunnerDefaultNumWorkerThreads();
+		nworkers = MAX(nworkers / njobs, 1);
+
+		/* A lone image is decoded right here, and may be previewed while we
+		   do so (unless it’s only being preloaded, or a preview would show
+		   up at the wrong size).  A batch is decoded all at once instead. */
+		if (njobs == 1) {
+			bool preview = !pflag && !Uflag && !Lflag
+			            && mode != EWD_PLACE_CENTER
+			            && mode != EWD_PLACE_TILE;
+			job_decode(jobs, preview ? jobs[0].name : NULL);
+		}
+		else {
+			for (size_t i = 0; i < njobs; i++) {
+				if ((errno = pthread_create(&jobs[i].thrd, NULL, job_thrd,
+				                            jobs + i)))
+				{
+					die("pthread_create");
+				}
+			}
+			for (size_t i = 0; i < njobs; i++) {
+				if ((errno = pthread_join(jobs[i].thrd, NULL)))
+					die("pthread_join");
+			}
+		}
+	}
+
+	sockfd = srv_connect();
+	if (sflag)
+		srv_stats(sockfd, name);
+	else if (vflag) {
+		if (bflag)
+			view.flags |= EWD_VIEW_BOUNCE;
+		srv_view(sockfd, view, name);
+	} else if (Sflag)
+		srv_handle(sockfd, EWD_MSG_SHOW, id, name);
+	else if (uflag)
+		srv_handle(sockfd, EWD_MSG_UNLOAD, id, NULL);
+	else if (Lflag && (cflag || tflag))
+		srv_layer(sockfd, (struct img){.fd = -1}, name);
+	else if (Lflag) {
+		if (jobs[0].img.nframes > 1)
+			warnx("%s: Animations can’t be used as layers", jobs[0].file);
+		else
+			srv_layer(sockfd, jobs[0].img, jobs[0].name);
+		close(jobs[0].img.fd);
+		free(jobs[0].img.durs);
+	} else if (Uflag) {
+		if (jobs[0].img.nframes > 1)
+			warnx("%s: Animations can’t be used as patches", jobs[0].file);
+		else
+			srv_update(sockfd, jobs[0].img, upd_x, upd_y, jobs[0].name);
+		close(jobs[0].img.fd);
+		free(jobs[0].img.durs);
+	}
+	else if (pflag) {
+		/* Print the handle of each image, in the order they were given */
+		for (size_t i = 0; i < njobs; i++) {
+			if (jobs[i].img.nframes > 1)
+				warnx("%s: Animations can’t be preloaded", jobs[i].file);
+			else if ((id = srv_preload(sockfd, jobs[i].img)) == 0)
+				warnx("%s: Failed to preload image", jobs[i].file);
+			else
+				printf("%" PRIu32 "\n", id);
+			close(jobs[i].img.fd);
+			free(jobs[i].img.durs);
+		}
+	} else {
+		/* Everything goes over the one connection */
+		for (size_t i = 0; i < njobs; i++) {
+			srv_msg(sockfd, jobs[i].img, jobs[i].name);
+			if (jobs[i].img.fd != -1)
+				close(jobs[i].img.fd);
+			free(jobs[i].img.durs);
+		}
+	}
+
+	free(jobs);
+	close(sockfd);
+	return rv;
+}
+
+/* Parse the remaining arguments into a list of files, each optionally
+   preceded by the name of the display to set it on.  The first file gets the
+   display given as a regular option, if any. */
+size_t
+jobs_parse(int argc, char **argv, char *name, struct job **jobs)
+{
+	size_t n = 0;
+	bool stdin_used = false;
+
+	if (argc == 0) {
+		*jobs = xcalloc(1, sizeof(**jobs));
+		**jobs = (struct job){.name = name, .file = "-"};
+		return 1;
+	}
+
+	*jobs = xcalloc(argc, sizeof(**jobs));
+	for (int i = 0; i < argc; i++) {
+		if (streq(argv[i], "-d") || streq(argv[i], "--display")) {
+			if (++i == argc)
+				usage(argv[-optind]);
+			name = argv[i];
+		} else if (strncmp(argv[i], "--display=", 10) == 0)
+			name = argv[i] + 10;
+		else if (strncmp(argv[i], "-d", 2) == 0)
+			name = argv[i] + 2;
 		else {
-			int fd = open(argv[0], O_RDONLY);
-			if (fd == -1)
-				die("open: %s", argv[0]);
-			img_e.buf = process(argv[0], fd, &img_e.size);
-			close(fd);
+			if (streq(argv[i], "-")) {
+				if (stdin_used)
+					diex("The standard input can only be read once");
+				stdin_used = true;
+			}
+			(*jobs)[n++] = (struct job){.name = name, .file = argv[i]};
+			name = "";
 		}
-		img_d = jxl_decode(img_e);
 	}
 
+	/* A trailing display name without a file to go with it */
+	if (n == 0 || !streq(name, ""))
+		usage(argv[-optind]);
+	return n;
+}
+
+void *
+job_thrd(void *job)
+{
+	job_decode(job, NULL);
+	return NULL;
+}
+
+/* Decode the file of a job, previewing it on the display ‘preview’ if not
+   NULL */
+void
+job_decode(struct job *job, char *preview)
+{
+	int fd = STDIN_FILENO;
+	u32 w = 0, h = 0;
+	bool cacheable;
+	bool cover = mode == EWD_PLACE_FILL || mode == EWD_PLACE_STRETCH;
+	struct input in;
+	struct cache_key key;
+	enum { FMT_FF, FMT_JPEG, FMT_JXL, FMT_QOI } fmt;
+
+	if (!streq(job->file, "-") && (fd = open(job->file, O_RDONLY)) == -1)
+		die("open: %s", job->file);
+
+	/* Raw pixels have no header to identify them by */
+	if (rflag) {
+		job->img = raw_decode(job->file, fd, raw_w, raw_h);
+		goto out;
+	}
+
+	/* Otherwise go by the magic number at the start of the file.  JPEGs start
+	   with an SOI marker followed by another marker.  Anything unknown is
+	   assumed to be JPEG XL. */
+	in = in_open(job->file, fd);
+	in_peek(&in, 8);
+	if (in.hlen >= 8 && memcmp(in.head, "farbfeld", 8) == 0)
+		fmt = FMT_FF;
+	else if (in.hlen >= 4 && memcmp(in.head, "qoif", 4) == 0)
+		fmt = FMT_QOI;
+	else if (in.hlen >= 3 && in.head[0] == 0xFF && in.head[1] == 0xD8
+	         && in.head[2] == 0xFF)
+	{
+		/* A spanned image is shown larger than any one display, and
+		   centered or tiled images, patches and layers are shown at their
+		   own size */
+		fmt = FMT_JPEG;
+		if (!aflag && !Uflag && !Lflag && mode != EWD_PLACE_CENTER
+		    && mode != EWD_PLACE_TILE)
+		{
+			srv_outputs(job->name, &w, &h);
+		}
+	} else
+		fmt = FMT_JXL;
+
+	/* Only JPEGs are decoded differently depending on the display size */
+	cacheable = cache_key(&key, fd, w, h, cover);
+	if (cacheable && cache_get(&key, &job->img)) {
+		in_close(&in);
+		goto out;
+	}
+
+	switch (fmt) {
+	case FMT_FF:
+		job->img = ff_decode(&in);
+		break;
+	case FMT_JPEG:
+		job->img = jpeg_decode(&in, w, h, cover);
+		break;
+	case FMT_JXL:
+		job->img = jxl_decode(&in, preview);
+		break;
+	case FMT_QOI:
+		job->img = qoi_load(&in);
+		break;
+	}
+	if (cacheable)
+		cache_put(&key, &job->img);
+
+out:
+	if (fd != STDIN_FILENO)
+		close(fd);
+}
+
+int
+srv_connect(void)
+{
+	int sockfd;
+	struct sockaddr_un saddr = {
+		.sun_family = AF_UNIX,
+	};
+
 	memcpy(saddr.sun_path, ewd_sock_path(), sizeof(saddr.sun_path));
 	if ((sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
 		die("socket");
@@ -120,22 +481,66 @@ main(int argc, char **argv)
 			diex("ewd daemon is not running");
 		die("connect: %s", saddr.sun_path);
 	}
-	abgr2argb(img_d);
-	srv_msg(sockfd, img_d, name);
-
-	close(sockfd);
-	close(img_d.fd);
-	return rv;
+	return sockfd;
 }
 
 void
 srv_msg(int sockfd, struct img mmf, char *name)
 {
+	u32 type = EWD_MSG_SET;
+	u32 flags = aflag ? EWD_SET_SPAN : 0, m = mode;
 	size_t nlen = strlen(name);
+	size_t dlen = mmf.nframes * sizeof(*mmf.durs);
 	u8 fd_buf[CMSG_SPACE(sizeof(int))];
 	struct iovec iovs[] = {
-		{.iov_base = &mmf.w, .iov_len = sizeof(mmf.w)},
-		{.iov_base = &mmf.h, .iov_len = sizeof(mmf.h)},
+		{.iov_base = &type,        .iov_len = sizeof(type)       },
+		{.iov_base = &mmf.w,       .iov_len = sizeof(mmf.w)      },
+		{.iov_base = &mmf.h,       .iov_len = sizeof(mmf.h)      },
+		{.iov_base = &mmf.nframes, .iov_len = sizeof(mmf.nframes)},
+		{.iov_base = &flags,       .iov_len = sizeof(flags)      },
+		{.iov_base = &m,           .iov_len = sizeof(m)          },
+		{.iov_base = &bg,          .iov_len = sizeof(bg)         },
+		{.iov_base = &nlen,        .iov_len = sizeof(nlen)       },
+		{.iov_base = name,         .iov_len = nlen               },
+		{.iov_base = mmf.durs,     .iov_len = dlen               },
+	};
+	struct msghdr msg = {
+		.msg_iov = iovs,
+		.msg_iovlen = lengthof(iovs),
+		.msg_control = fd_buf,
+		.msg_controllen = sizeof(fd_buf),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+	/* Clearing a display doesn’t involve an image */
+	if (mmf.fd == -1) {
+		msg.msg_control = NULL;
+		msg.msg_controllen = 0;
+	} else {
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &mmf.fd, sizeof(mmf.fd));
+	}
+
+	if (sendmsg(sockfd, &msg, 0) == -1)
+		die("sendmsg");
+}
+
+/* Draw the image ‘img’ over the still image shown on the display ‘name’ with
+   its top-left corner at ‘x’,‘y’ */
+void
+srv_update(int sockfd, struct img img, u32 x, u32 y, char *name)
+{
+	u32 type = EWD_MSG_UPDATE;
+	size_t nlen = strlen(name);
+	u8 fd_buf[CMSG_SPACE(sizeof(int))];
+	struct iovec iovs[] = {
+		{.iov_base = &type,  .iov_len = sizeof(type) },
+		{.iov_base = &x,     .iov_len = sizeof(x)    },
+		{.iov_base = &y,     .iov_len = sizeof(y)    },
+		{.iov_base = &img.w, .iov_len = sizeof(img.w)},
+		{.iov_base = &img.h, .iov_len = sizeof(img.h)},
 		{.iov_base = &nlen,  .iov_len = sizeof(nlen) },
 		{.iov_base = name,   .iov_len = nlen         },
 	};
@@ -146,34 +551,419 @@ srv_msg(int sockfd, struct img mmf, char *name)
 		.msg_controllen = sizeof(fd_buf),
 	};
 	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
 	cmsg->cmsg_level = SOL_SOCKET;
 	cmsg->cmsg_type = SCM_RIGHTS;
 	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
-	memcpy(CMSG_DATA(cmsg), &mmf.fd, sizeof(mmf.fd));
+	memcpy(CMSG_DATA(cmsg), &img.fd, sizeof(img.fd));
+
+	if (sendmsg(sockfd, &msg, 0) == -1)
+		die("sendmsg");
+}
+
+/* Set the layer given to -L on the display ‘name’ to the image ‘img’, or if
+   it has no file descriptor to the colour given to -t or to nothing at all.
+   The daemon takes images with premultiplied alpha, which most decoders
+   don’t give us, so we send it a premultiplied copy. */
+void
+srv_layer(int sockfd, struct img img, char *name)
+{
+	u32 type = EWD_MSG_LAYER;
+	u32 x = lyr_x, y = lyr_y, w = img.w, h = img.h, color = 0;
+	size_t nlen = strlen(name), size = (size_t)w * h * sizeof(xrgb);
+	const xrgb *src;
+	struct img pm = {.fd = -1};
+	u8 fd_buf[CMSG_SPACE(sizeof(int))];
+	struct iovec iovs[] = {
+		{.iov_base = &type,   .iov_len = sizeof(type)  },
+		{.iov_base = &lyr_id, .iov_len = sizeof(lyr_id)},
+		{.iov_base = &x,      .iov_len = sizeof(x)     },
+		{.iov_base = &y,      .iov_len = sizeof(y)     },
+		{.iov_base = &w,      .iov_len = sizeof(w)     },
+		{.iov_base = &h,      .iov_len = sizeof(h)     },
+		{.iov_base = &color,  .iov_len = sizeof(color) },
+		{.iov_base = &nlen,   .iov_len = sizeof(nlen)  },
+		{.iov_base = name,    .iov_len = nlen          },
+	};
+	struct msghdr msg = {
+		.msg_iov = iovs,
+		.msg_iovlen = lengthof(iovs),
+	};
+	struct cmsghdr *cmsg;
+
+	/* A tint covers the whole display */
+	if (tflag) {
+		x = y = 0;
+		w = h = UINT32_MAX;
+		color = premul(tint);
+	} else if (img.fd != -1) {
+		if ((src = mmap(NULL, size, PROT_READ, MAP_PRIVATE, img.fd, 0))
+		    == MAP_FAILED)
+		{
+			die("mmap");
+		}
+		pm = img_new(w, h);
+		for (size_t i = 0; i < (size_t)w * h; i++)
+			((xrgb *)pm.buf)[i] = premul(src[i]);
+		munmap((void *)src, size);
+		munmap(pm.buf, pm.size);
+
+		msg.msg_control = fd_buf;
+		msg.msg_controllen = sizeof(fd_buf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &pm.fd, sizeof(pm.fd));
+	}
 
 	if (sendmsg(sockfd, &msg, 0) == -1)
 		die("sendmsg");
+	if (pm.fd != -1) {
+		close(pm.fd);
+		free(pm.durs);
+	}
 }
 
+/* Get the largest width and height amongst the displays called ‘name’, or
+   0×0 if there are none */
 void
-abgr2argb(struct img f)
+srv_outputs(char *name, u32 *w, u32 *h)
 {
-	for (size_t i = 0; i < f.size; i += 4) {
-		u8 tmp = f.buf[i + 0];
-		f.buf[i + 0] = f.buf[i + 2];
-		f.buf[i + 2] = tmp;
+	int sockfd = srv_connect();
+	u32 type = EWD_MSG_OUTPUTS, ow, oh;
+	size_t nlen = strlen(name);
+	FILE *fp;
+	struct iovec iovs[] = {
+		{.iov_base = &type, .iov_len = sizeof(type)},
+		{.iov_base = &nlen, .iov_len = sizeof(nlen)},
+		{.iov_base = name,  .iov_len = nlen        },
+	};
+
+	if (writev(sockfd, iovs, lengthof(iovs)) == -1)
+		die("writev");
+	shutdown(sockfd, SHUT_WR);
+
+	if (!(fp = fdopen(sockfd, "r")))
+		die("fdopen");
+	*w = *h = 0;
+	while (fscanf(fp, "%*s %" SCNu32 " %" SCNu32, &ow, &oh) == 2) {
+		*w = MAX(*w, ow);
+		*h = MAX(*h, oh);
 	}
+	if (ferror(fp))
+		die("read");
+	fclose(fp);
 }
 
+/* Send every eighth pixel of every eighth row of the partially decoded frame
+   ‘f’ as a preview, which the daemon will show until the full image arrives */
+void
+srv_preview(struct img f, char *name)
+{
+	int sockfd;
+	u32 dur = 0;
+	xrgb *src = (xrgb *)f.buf, *dst;
+	struct img pv = {
+		.w = (f.w + 7) / 8,
+		.h = (f.h + 7) / 8,
+		.nframes = 1,
+		.durs = &dur,
+	};
+
+	pv.size = (size_t)pv.w * pv.h * sizeof(xrgb);
+	if ((pv.fd = memfd_create("ewctl-preview", 0)) == -1)
+		die("memfd_create");
+	if (ftruncate(pv.fd, pv.size) == -1)
+		die("ftruncate");
+	if ((dst = mmap(NULL, pv.size, PROT_WRITE, MAP_SHARED, pv.fd, 0))
+	    == MAP_FAILED)
+	{
+		die("mmap");
+	}
+
+	for (u32 y = 0; y < pv.h; y++) {
+		for (u32 x = 0; x < pv.w; x++)
+			dst[y * pv.w + x] = src[(size_t)y * 8 * f.w + x * 8];
+	}
+	munmap(dst, pv.size);
+
+	sockfd = srv_connect();
+	srv_msg(sockfd, pv, name);
+	close(sockfd);
+	close(pv.fd);
+}
+
+/* Preload an image, returning its handle or 0 on failure */
+u32
+srv_preload(int sockfd, struct img img)
+{
+	u32 type = EWD_MSG_PRELOAD, id;
+	u8 fd_buf[CMSG_SPACE(sizeof(int))];
+	struct iovec iovs[] = {
+		{.iov_base = &type,  .iov_len = sizeof(type) },
+		{.iov_base = &img.w, .iov_len = sizeof(img.w)},
+		{.iov_base = &img.h, .iov_len = sizeof(img.h)},
+	};
+	struct msghdr msg = {
+		.msg_iov = iovs,
+		.msg_iovlen = lengthof(iovs),
+		.msg_control = fd_buf,
+		.msg_controllen = sizeof(fd_buf),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &img.fd, sizeof(img.fd));
+
+	if (sendmsg(sockfd, &msg, 0) == -1)
+		die("sendmsg");
+	if (recv(sockfd, &id, sizeof(id), MSG_WAITALL) != sizeof(id))
+		diex("Failed to receive preload handle");
+	return id;
+}
+
+/* Send a message referring to a preloaded image, optionally followed by a
+   display name */
+void
+srv_handle(int sockfd, u32 type, u32 id, char *name)
+{
+	size_t nlen = name ? strlen(name) : 0;
+	struct iovec iovs[] = {
+		{.iov_base = &type, .iov_len = sizeof(type)},
+		{.iov_base = &id,   .iov_len = sizeof(id)  },
+		{.iov_base = &nlen, .iov_len = sizeof(nlen)},
+		{.iov_base = name,  .iov_len = nlen        },
+	};
+
+	if (writev(sockfd, iovs, name ? lengthof(iovs) : 2) == -1)
+		die("writev");
+}
+
+/* Request frame pacing statistics and copy the reply to the standard output */
+void
+srv_stats(int sockfd, char *name)
+{
+	u32 type = EWD_MSG_STATS;
+	size_t nlen = strlen(name);
+	char buf[BUFSIZ];
+	ssize_t nr;
+	struct iovec iovs[] = {
+		{.iov_base = &type, .iov_len = sizeof(type)},
+		{.iov_base = &nlen, .iov_len = sizeof(nlen)},
+		{.iov_base = name,  .iov_len = nlen        },
+	};
+
+	if (writev(sockfd, iovs, lengthof(iovs)) == -1)
+		die("writev");
+	shutdown(sockfd, SHUT_WR);
+
+	while ((nr = read(sockfd, buf, sizeof(buf))) > 0) {
+		if (fwrite(buf, 1, nr, stdout) != (size_t)nr)
+			die("fwrite");
+	}
+	if (nr == -1)
+		die("read");
+}
+
+void
+srv_view(int sockfd, struct view v, char *name)
+{
+	u32 type = EWD_MSG_VIEW;
+	size_t nlen = strlen(name);
+	struct iovec iovs[] = {
+		{.iov_base = &type, .iov_len = sizeof(type)},
+		{.iov_base = &v,    .iov_len = sizeof(v)   },
+		{.iov_base = &nlen, .iov_len = sizeof(nlen)},
+		{.iov_base = name,  .iov_len = nlen        },
+	};
+
+	if (writev(sockfd, iovs, lengthof(iovs)) == -1)
+		die("writev");
+}
+
+/* Parse dimensions of the form ‘WxH’ */
+void
+dims_parse(const char *s, u32 *w, u32 *h)
+{
+	char *p;
+	unsigned long n, m;
+
+	errno = 0;
+	n = strtoul(s, &p, 10);
+	if (errno || p == s || n == 0 || n > UINT32_MAX || *p != 'x')
+		diex("Invalid dimensions ‘%s’", s);
+	m = strtoul(p + 1, &p, 10);
+	if (errno || m == 0 || m > UINT32_MAX || *p)
+		diex("Invalid dimensions ‘%s’", s);
+	*w = n;
+	*h = m;
+}
+
+/* Parse a colour of the form ‘RRGGBB’, optionally preceded by a ‘#’ */
+xrgb
+color_parse(const char *s)
+{
+	char *p;
+	unsigned long n;
+	const char *q = *s == '#' ? s + 1 : s;
+
+	errno = 0;
+	n = strtoul(q, &p, 16);
+	if (errno || p - q != 6 || *p || n > 0xFFFFFF)
+		diex("Invalid color ‘%s’", s);
+	return n;
+}
+
+/* Parse the name of a placement mode */
+u32
+mode_parse(const char *s)
+{
+	static const char *modes[] = {
+		[EWD_PLACE_FILL] = "fill",
+		[EWD_PLACE_FIT] = "fit",
+		[EWD_PLACE_CENTER] = "center",
+		[EWD_PLACE_STRETCH] = "stretch",
+		[EWD_PLACE_TILE] = "tile",
+	};
+
+	for (size_t i = 0; i < lengthof(modes); i++) {
+		if (streq(s, modes[i]))
+			return i;
+	}
+	diex("Invalid mode ‘%s’", s);
+}
+
+/* Parse a position of the form ‘x,y’ */
+void
+pos_parse(const char *s, u32 *x, u32 *y)
+{
+	char *p;
+	unsigned long n, m;
+
+	errno = 0;
+	n = strtoul(s, &p, 10);
+	if (errno || p == s || n > UINT32_MAX || *p != ',')
+		diex("Invalid position ‘%s’", s);
+	m = strtoul(p + 1, &p, 10);
+	if (errno || m > UINT32_MAX || *p)
+		diex("Invalid position ‘%s’", s);
+	*x = n;
+	*y = m;
+}
+
+/* Parse a colour of the form ‘AARRGGBB’, optionally preceded by a ‘#’ */
+u32
+tint_parse(const char *s)
+{
+	char *p;
+	unsigned long n;
+	const char *q = *s == '#' ? s + 1 : s;
+
+	errno = 0;
+	n = strtoul(q, &p, 16);
+	if (errno || p - q != 8 || *p || n > UINT32_MAX)
+		diex("Invalid color ‘%s’", s);
+	return n;
+}
+
+/* Premultiply the colour channels of the ARGB pixel ‘px’ by its alpha */
+u32
+premul(u32 px)
+{
+	u32 a = px >> 24;
+	u32 r = ((px >> 16 & 0xFF) * a + 127) / 255;
+	u32 g = ((px >> 8 & 0xFF) * a + 127) / 255;
+	u32 b = ((px & 0xFF) * a + 127) / 255;
+	return a << 24 | r << 16 | g << 8 | b;
+}
+
+/* Parse a layer of the form ‘n[,x,y]’ */
+void
+layer_parse(const char *s)
+{
+	char *p;
+	unsigned long n;
+
+	errno = 0;
+	n = strtoul(s, &p, 10);
+	if (errno || p == s || n > UINT32_MAX || (*p && *p != ','))
+		diex("Invalid layer ‘%s’", s);
+	lyr_id = n;
+	if (*p)
+		pos_parse(p + 1, &lyr_x, &lyr_y);
+}
+
+/* Parse the handle of a preloaded image */
+u32
+id_parse(const char *s)
+{
+	char *p;
+	unsigned long n;
+
+	errno = 0;
+	n = strtoul(s, &p, 10);
+	if (errno || p == s || *p || n == 0 || n > UINT32_MAX)
+		diex("Invalid handle ‘%s’", s);
+	return n;
+}
+
+/* Parse a view of the form ‘x,y,zoom[,duration]’ */
+struct view
+view_parse(const char *s)
+{
+	char *p;
+	const char *q = s;
+	u32 *fields[4];
+	struct view v = {0};
+
+	fields[0] = &v.x;
+	fields[1] = &v.y;
+	fields[2] = &v.zoom;
+	fields[3] = &v.dur;
+
+	for (size_t i = 0; i < lengthof(fields); i++) {
+		unsigned long n;
+
+		errno = 0;
+		n = strtoul(q, &p, 10);
+		if (errno || p == q || n > UINT32_MAX)
+			diex("Invalid view ‘%s’", s);
+		*fields[i] = n;
+
+		if (*p == 0 && i >= 2)
+			break;
+		if (*p != ',' || i == lengthof(fields) - 1)
+			diex("Invalid view ‘%s’", s);
+		q = p + 1;
+	}
+
+	if (v.x > 1000 || v.y > 1000 || v.zoom < 100)
+		diex("Invalid view ‘%s’", s);
+	return v;
+}
+
+/* Decode a JPEG XL image.  Animated images are decoded in full, with each
+   (coalesced) frame stored one after the other in the output memfd.  Input
+   that can’t be mapped is decoded as it comes in, so that decoding overlaps
+   with reading from slow sources such as pipes.  If ‘name’ isn’t NULL, large
+   still images are previewed on that display as soon as a low-resolution
+   version is available. */
 struct img
-jxl_decode(struct bs img)
+jxl_decode(struct input *in, char *name)
 {
-	void *tpr;
-	size_t nthrds;
-	struct img pix;
+	bool previewed = false;
+	u32 ms;
+	size_t fsize = 0;
+	struct img pix = {.fd = -1};
+	struct img frame;
+	void *runner;
 	JxlDecoder *d;
 	JxlDecoderStatus res;
 	JxlBasicInfo info;
+	JxlFrameHeader fhdr;
 	JxlPixelFormat fmt = {
 		.align = 0,
 		.data_type = JXL_TYPE_UINT8,
@@ -184,40 +974,95 @@ jxl_decode(struct bs img)
 	if (!(d = JxlDecoderCreate(NULL)))
 		diex("Failed to allocate JXL decoder");
 
-	nthrds = JxlThreadParallelRunnerDefaultNumWorkerThreads();
-	if (!(tpr = JxlThreadParallelRunnerCreate(NULL, nthrds)))
+	if (!(runner = JxlThreadParallelRunnerCreate(NULL, nworkers)))
 		diex("Failed to allocate parallel runner");
-
-	if (JxlDecoderSetParallelRunner(d, JxlThreadParallelRunner, tpr))
+	if (JxlDecoderSetParallelRunner(d, JxlThreadParallelRunner, runner))
 		diex("Failed to set parallel runner");
 
-	if (JxlDecoderSubscribeEvents(d, JXL_DEC_FULL_IMAGE))
+	if (JxlDecoderSubscribeEvents(d, JXL_DEC_BASIC_INFO | JXL_DEC_FRAME
+	                                     | JXL_DEC_FRAME_PROGRESSION
+	                                     | JXL_DEC_FULL_IMAGE))
+	{
 		diex("Failed to subscribe to events");
+	}
+	if (JxlDecoderSetProgressiveDetail(d, kDC))
+		diex("Failed to set progressive detail");
 
-	if (JxlDecoderSetInput(d, img.buf, img.size))
-		diex("Failed to set input data");
-	JxlDecoderCloseInput(d);
+	in_feed(d, in);
 
-	while ((res = JxlDecoderProcessInput(d)) != JXL_DEC_FULL_IMAGE) {
+	while ((res = JxlDecoderProcessInput(d)) != JXL_DEC_SUCCESS) {
 		switch (res) {
+		case JXL_DEC_BASIC_INFO:
+			if (JxlDecoderGetBasicInfo(d, &info))
+				diex("Failed to get dimensions of JXL image");
+			pix.w = info.xsize;
+			pix.h = info.ysize;
+			break;
+		case JXL_DEC_FRAME:
+			if (JxlDecoderGetFrameHeader(d, &fhdr))
+				diex("Failed to get frame header");
+			ms = 0;
+			if (info.have_animation && info.animation.tps_numerator) {
+				ms = (u64)fhdr.duration * 1000 * info.animation.tps_denominator
+				   / info.animation.tps_numerator;
+			}
+			pix.durs = xrealloc(pix.durs,
+			                    (pix.nframes + 1) * sizeof(*pix.durs));
+			pix.durs[pix.nframes] = ms;
+			break;
 		case JXL_DEC_NEED_IMAGE_OUT_BUFFER:
-			if (JxlDecoderImageOutBufferSize(d, &fmt, &pix.size))
+			if (JxlDecoderImageOutBufferSize(d, &fmt, &fsize))
 				diex("Failed to get image output buffer size");
-			if ((pix.fd = memfd_create("ewctl-mem", 0)) == -1)
+			if (pix.fd == -1 && (pix.fd = memfd_create("ewctl-mem", 0)) == -1)
 				die("memfd_create");
-			if (ftruncate(pix.fd, pix.size) == -1)
+			if (pix.size > 0 && pix.size + fsize > ANIM_MAX) {
+				diex("Animation is too large to decode (over %zu MiB)",
+				     ANIM_MAX >> 20);
+			}
+
+			/* Grow the memfd by one frame, and remap it to fit */
+			if (ftruncate(pix.fd, pix.size + fsize) == -1)
 				die("ftruncate");
-			pix.buf = mmap(NULL, pix.size, PROT_READ | PROT_WRITE, MAP_SHARED,
-			               pix.fd, 0);
+			pix.buf = pix.size == 0
+			            ? mmap(NULL, fsize, PROT_READ | PROT_WRITE, MAP_SHARED,
+			                   pix.fd, 0)
+			            : mremap(pix.buf, pix.size, pix.size + fsize,
+			                     MREMAP_MAYMOVE);
 			if (pix.buf == MAP_FAILED)
 				die("mmap");
-			if (JxlDecoderSetImageOutBuffer(d, &fmt, pix.buf, pix.size))
-				diex("Failed to set image output buffer");
+
+			/* Rather than having the decoder write RGBA into the memfd and
+			   converting it to XRGB afterwards, convert each run of pixels
+			   while it’s still hot in the cache */
+			frame = pix;
+			frame.buf += pix.size;
+			if (JxlDecoderSetImageOutCallback(d, &fmt, jxl_out, &frame))
+				diex("Failed to set image output callback");
+			pix.size += fsize;
+			break;
+		case JXL_DEC_FRAME_PROGRESSION:
+			/* The DC of the image is complete, so flushing gives us the
+			   image at an eighth of its detail upsampled to full size */
+			if (!name || previewed || info.have_animation
+			    || (u64)pix.w * pix.h < PREVIEW_MIN)
+			{
+				break;
+			}
+			if (JxlDecoderFlushImage(d) == JXL_DEC_SUCCESS) {
+				srv_preview(frame, name);
+				previewed = true;
+			}
+			break;
+		case JXL_DEC_FULL_IMAGE:
+			pix.nframes++;
 			break;
 		case JXL_DEC_NEED_MORE_INPUT:
-			diex("Input image was truncated");
+			if (in->eof)
+				diex("Input image was truncated");
+			in_feed(d, in);
+			break;
 		case JXL_DEC_ERROR:;
-			JxlSignature sig = JxlSignatureCheck(pix.buf, pix.size);
+			JxlSignature sig = JxlSignatureCheck(in->head, in->hlen);
 			die("Failed to decode file: %s",
 			    (sig == JXL_SIG_CODESTREAM || sig == JXL_SIG_CONTAINER)
 			        ? "Possibly file"
@@ -227,45 +1072,43 @@ jxl_decode(struct bs img)
 		}
 	}
 
-	if (JxlDecoderGetBasicInfo(d, &info))
-		diex("Failed to get dimensions of JXL image");
-
-	pix.w = info.xsize;
-	pix.h = info.ysize;
-
-	JxlThreadParallelRunnerDestroy(tpr);
 	JxlDecoderDestroy(d);
+	JxlThreadParallelRunnerDestroy(runner);
+	in_close(in);
 
 	return pix;
 }
 
-u8 *
-process(const char *name, int fd, size_t *size)
+/* Receive a run of decoded pixels.  This may be called from multiple threads
+   at once, but never for overlapping pixels. */
+void
+jxl_out(void *frame, size_t x, size_t y, size_t n, const void *px)
 {
-	u8 *buf = NULL;
-	size_t len = 0;
-	struct stat sb;
-
-	if (fstat(fd, &sb) == -1)
-		die("fstat: %s", name);
-
-	for (;;) {
-		/* This could *potentially* cause issues on some wack system where
-		   sb.st_blksize is absolutely massive and the stack size is tiny.
-		   Until I see such a system though, I do not care; the VLA will
-		   suffice. */
-		u8 tmp[sb.st_blksize];
-		ssize_t nr;
-
-		if ((nr = read(fd, tmp, sb.st_blksize)) == -1)
-			die("read: %s", name);
-		if (!nr)
-			break;
-		buf = xrealloc(buf, len + nr);
-		memcpy(buf + len, tmp, nr);
-		len += nr;
+	struct img *f = frame;
+	rgba2xrgb((xrgb *)f->buf + y * f->w + x, px, n);
+}
+
+/* Give the decoder more input.  Whatever the decoder hasn’t consumed yet is
+   kept, and whatever a single read(2) returns is appended to it.  The first
+   time around the decoder just gets whatever was read while identifying the
+   file type. */
+void
+in_feed(JxlDecoder *d, struct input *in)
+{
+	size_t rem;
+
+	if (!in->mapped && (in->fed || in->len == 0)) {
+		if (in->fed) {
+			rem = JxlDecoderReleaseInput(d);
+			memmove(in->buf, in->buf + in->len - rem, rem);
+			in->len = rem;
+		}
+		in_read(in);
 	}
+	in->fed = true;
 
-	*size = len;
-	return buf;
+	if (JxlDecoderSetInput(d, in->buf, in->len))
+		diex("Failed to set input data");
+	if (in->eof)
+		JxlDecoderCloseInput(d);
 }
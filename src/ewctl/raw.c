@@ -0,0 +1,147 @@
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "img.h"
+#include "input.h"
+#include "qoi.h"
+#include "swizzle.h"
+
+/* Size of the farbfeld header */
+#define FF_HDR 16
+
+static u32 be32(const u8 *);
+
+/* Take raw XRGB pixels of the given dimensions from ‘fd’.  A regular file
+   holding exactly that is already what the daemon wants, so it’s copied into
+   a memfd in the kernel without so much as being mapped.  The daemon holds
+   onto the image long after we exit, so the memfd is sealed against the
+   changes that the user could make to their own file.  Anything else is read
+   straight into a memfd. */
+struct img
+raw_decode(const char *name, int fd, u32 w, u32 h)
+{
+	size_t off = 0;
+	ssize_t nr;
+	off_t pos = 0;
+	struct stat sb;
+	struct img img;
+
+	if (fstat(fd, &sb) == -1)
+		die("fstat: %s", name);
+
+	if (S_ISREG(sb.st_mode)) {
+		if ((u64)sb.st_size != (u64)w * h * sizeof(xrgb))
+			diex("%s: Size doesn’t match dimensions %" PRIu32 "×%" PRIu32,
+			     name, w, h);
+		img = (struct img){
+			.w = w,
+			.h = h,
+			.nframes = 1,
+			.durs = xcalloc(1, sizeof(u32)),
+			.size = sb.st_size,
+		};
+		img.fd = memfd_create("ewctl-mem", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		if (img.fd == -1)
+			die("memfd_create");
+		while ((size_t)pos < img.size) {
+			if ((nr = sendfile(img.fd, fd, &pos, img.size - pos)) == -1) {
+				if (errno == EINTR)
+					continue;
+				die("sendfile: %s", name);
+			}
+			if (nr == 0)
+				diex("Input image was truncated");
+		}
+		if (fcntl(img.fd, F_ADD_SEALS,
+		          F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+		    == -1)
+		{
+			die("fcntl");
+		}
+		return img;
+	}
+
+	img = img_new(w, h);
+	while (off < img.size) {
+		if ((nr = read(fd, img.buf + off, img.size - off)) == -1) {
+			if (errno == EINTR)
+				continue;
+			die("read: %s", name);
+		}
+		if (nr == 0)
+			diex("Input image was truncated");
+		off += nr;
+	}
+	return img;
+}
+
+/* Decode a farbfeld image.  Pixels are converted as soon as they’re read,
+   only keeping the odd bytes of a pixel split across reads around. */
+struct img
+ff_decode(struct input *in)
+{
+	size_t n, done = 0, off = FF_HDR;
+	struct img img;
+
+	in_peek(in, FF_HDR);
+	if (in->len < FF_HDR)
+		diex("Input image was truncated");
+	img = img_new(be32(in->buf + 8), be32(in->buf + 12));
+
+	for (size_t npx = (size_t)img.w * img.h;;) {
+		n = MIN((in->len - off) / 8, npx - done);
+		rgba16be2xrgb((xrgb *)img.buf + done, in->buf + off, n);
+		done += n;
+		off += n * 8;
+
+		if (done == npx)
+			break;
+		if (in->eof)
+			diex("Input image was truncated");
+		memmove(in->buf, in->buf + off, in->len - off);
+		in->len -= off;
+		off = 0;
+		in_read(in);
+	}
+
+	in_close(in);
+	return img;
+}
+
+/* Decode a QOI image.  The format is inherently sequential, so the whole
+   input is read before decoding it straight into the memfd. */
+struct img
+qoi_load(struct input *in)
+{
+	struct img img;
+
+	in_peek(in, SIZE_MAX);
+	if (in->len < QOI_HDR)
+		diex("Input image was truncated");
+	img = img_new(be32(in->buf + 4), be32(in->buf + 8));
+
+	if (!qoi_decode((xrgb *)img.buf, (size_t)img.w * img.h,
+	                in->buf + QOI_HDR, in->len - QOI_HDR))
+	{
+		diex("Input image was truncated");
+	}
+
+	in_close(in);
+	return img;
+}
+
+u32
+be32(const u8 *p)
+{
+	return (u32)p[0] << 24 | (u32)p[1] << 16 | (u32)p[2] << 8 | p[3];
+}
@@ -0,0 +1,142 @@
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#	include <immintrin.h>
+#	define HAVE_X86 1
+#else
+#	define HAVE_X86 0
+#endif
+
+#include "common.h"
+#include "swizzle.h"
+
+static void rgba2xrgb_c(xrgb *restrict, const u8 *restrict, size_t);
+static void rgba16be2xrgb_c(xrgb *restrict, const u8 *restrict, size_t);
+#if HAVE_X86
+static void rgba2xrgb_avx2(xrgb *restrict, const u8 *restrict, size_t);
+static void rgba2xrgb_ssse3(xrgb *restrict, const u8 *restrict, size_t);
+static void rgba16be2xrgb_avx2(xrgb *restrict, const u8 *restrict, size_t);
+static void rgba16be2xrgb_ssse3(xrgb *restrict, const u8 *restrict, size_t);
+#endif
+
+void (*rgba2xrgb)(xrgb *restrict, const u8 *restrict, size_t) = rgba2xrgb_c;
+void (*rgba16be2xrgb)(xrgb *restrict, const u8 *restrict,
+                      size_t) = rgba16be2xrgb_c;
+
+/* Pick the widest byte shuffle that the CPU supports */
+void
+swizzle_init(void)
+{
+#if HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		rgba2xrgb = rgba2xrgb_avx2;
+		rgba16be2xrgb = rgba16be2xrgb_avx2;
+	} else if (__builtin_cpu_supports("ssse3")) {
+		rgba2xrgb = rgba2xrgb_ssse3;
+		rgba16be2xrgb = rgba16be2xrgb_ssse3;
+	}
+#endif
+}
+
+void
+rgba2xrgb_c(xrgb *restrict dst, const u8 *restrict src, size_t n)
+{
+	for (size_t i = 0; i < n; i++, src += 4) {
+		dst[i] = (xrgb)src[3] << 24 | (xrgb)src[0] << 16 | (xrgb)src[1] << 8
+		       | src[2];
+	}
+}
+
+/* Only the most significant byte of each channel is kept, which comes first
+   since the channels are big-endian */
+void
+rgba16be2xrgb_c(xrgb *restrict dst, const u8 *restrict src, size_t n)
+{
+	for (size_t i = 0; i < n; i++, src += 8) {
+		dst[i] = (xrgb)src[6] << 24 | (xrgb)src[0] << 16 | (xrgb)src[2] << 8
+		       | src[4];
+	}
+}
+
+#if HAVE_X86
+/* In memory an XRGB pixel is stored as the bytes B, G, R and X, so all we need
+   to do is swap the first and third byte of every pixel */
+#define SHUF 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15
+
+[[gnu::target("ssse3")]] void
+rgba2xrgb_ssse3(xrgb *restrict dst, const u8 *restrict src, size_t n)
+{
+	size_t i = 0;
+	__m128i m = _mm_setr_epi8(SHUF);
+
+	for (; i + 4 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i * 4));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(v, m));
+	}
+	rgba2xrgb_c(dst + i, src + i * 4, n - i);
+}
+
+/* The AVX2 shuffle works within each 128-bit lane, so the same mask is simply
+   repeated for both lanes */
+[[gnu::target("avx2")]] void
+rgba2xrgb_avx2(xrgb *restrict dst, const u8 *restrict src, size_t n)
+{
+	size_t i = 0;
+	__m256i m = _mm256_setr_epi8(SHUF, SHUF);
+
+	for (; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(v, m));
+	}
+	rgba2xrgb_c(dst + i, src + i * 4, n - i);
+}
+
+#undef SHUF
+
+/* Gather the high bytes of two 16-bit RGBA pixels into the B, G, R and X
+   bytes of two XRGB pixels, either in the low or the high half of a
+   register */
+#define SHUF16 4, 2, 0, 6, 12, 10, 8, 14
+#define ZERO8  -1, -1, -1, -1, -1, -1, -1, -1
+
+[[gnu::target("ssse3")]] void
+rgba16be2xrgb_ssse3(xrgb *restrict dst, const u8 *restrict src, size_t n)
+{
+	size_t i = 0;
+	__m128i lo = _mm_setr_epi8(SHUF16, ZERO8);
+	__m128i hi = _mm_setr_epi8(ZERO8, SHUF16);
+
+	for (; i + 4 <= n; i += 4) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(src + i * 8));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + i * 8 + 16));
+		_mm_storeu_si128((__m128i *)(dst + i),
+		                 _mm_or_si128(_mm_shuffle_epi8(a, lo),
+		                              _mm_shuffle_epi8(b, hi)));
+	}
+	rgba16be2xrgb_c(dst + i, src + i * 8, n - i);
+}
+
+/* The shuffles work within each 128-bit lane, leaving the quadwords holding
+   pixels 0–1, 4–5, 2–3 and 6–7, so the middle two need swapping */
+[[gnu::target("avx2")]] void
+rgba16be2xrgb_avx2(xrgb *restrict dst, const u8 *restrict src, size_t n)
+{
+	size_t i = 0;
+	__m256i lo = _mm256_setr_epi8(SHUF16, ZERO8, SHUF16, ZERO8);
+	__m256i hi = _mm256_setr_epi8(ZERO8, SHUF16, ZERO8, SHUF16);
+
+	for (; i + 8 <= n; i += 8) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(src + i * 8));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + i * 8 + 32));
+		__m256i v = _mm256_or_si256(_mm256_shuffle_epi8(a, lo),
+		                            _mm256_shuffle_epi8(b, hi));
+		v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+	}
+	rgba16be2xrgb_c(dst + i, src + i * 8, n - i);
+}
+
+#undef ZERO8
+#undef SHUF16
+#endif
@@ -0,0 +1,17 @@
+#ifndef EWCTL_SWIZZLE_H
+#define EWCTL_SWIZZLE_H
+
+#include <stddef.h>
+
+#include "common.h"
+
+/* Convert ‘n’ pixels of RGBA bytes to XRGB.  Points to the fastest
+   implementation supported by the CPU once swizzle_init() has been called. */
+extern void (*rgba2xrgb)(xrgb *restrict, const u8 *restrict, size_t);
+
+/* Likewise for pixels of big-endian 16-bit RGBA, as used by farbfeld */
+extern void (*rgba16be2xrgb)(xrgb *restrict, const u8 *restrict, size_t);
+
+void swizzle_init(void);
+
+#endif /* !EWCTL_SWIZZLE_H */
@@ -0,0 +1,218 @@
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#include <err.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <wayland-client-protocol.h>
+
+#include "anim.h"
+#include "common.h"
+#include "da.h"
+#include "scale.h"
+
+static void slot_scale(struct slot *, u32, enum filter);
+static void slot_free(void *, wl_buffer_t *);
+
+static const wl_buffer_listener_t slot_listener = {
+	.release = slot_free,
+};
+
+struct anim *
+anim_new(u8 *src, size_t size, u32 w, u32 h, u32 nframes, u32 *durs)
+{
+	struct anim *a = xmalloc(sizeof(*a));
+	*a = (struct anim){
+		.w = w,
+		.h = h,
+		.nframes = nframes,
+		.durs = durs,
+		.refs = 1,
+		.src = {src, size},
+	};
+	da_init(&a->rings, 1);
+	return a;
+}
+
+struct anim *
+anim_ref(struct anim *a)
+{
+	a->refs++;
+	return a;
+}
+
+void
+anim_unref(struct anim *a)
+{
+	if (--a->refs > 0)
+		return;
+	munmap(a->src.p, a->src.size);
+	free(a->rings.buf);
+	free(a->durs);
+	free(a);
+}
+
+struct ring *
+ring_acquire(struct anim *a, wl_shm_t *shm, u32 w, u32 h, u32 t, u32 fmt,
+             size_t cap)
+{
+	int mfd;
+	size_t n, fsize;
+	struct ring *r;
+	wl_shm_pool_t *pool;
+
+	da_foreach (&a->rings, p) {
+		if ((*p)->w == w && (*p)->h == h && (*p)->tform == t
+		    && (*p)->fmt == fmt)
+		{
+			(*p)->refs++;
+			return *p;
+		}
+	}
+
+	/* Shm pools are sized with an i32, so we can never exceed that no matter
+	   how much memory the user is willing to give us */
+	fsize = (size_t)w * h * fmt_bpp(fmt);
+	if (fsize == 0)
+		return NULL;
+	n = MIN(cap, INT32_MAX) / fsize;
+	if (n < a->nframes)
+		n = MIN(MAX(n, RING_MIN), a->nframes);
+	else
+		n = a->nframes;
+	if (n * fsize > INT32_MAX) {
+		warnx("Frames of size %" PRIu32 "x%" PRIu32 " are too large to animate",
+		      w, h);
+		return NULL;
+	}
+
+	r = xmalloc(sizeof(*r));
+	*r = (struct ring){
+		.w = w,
+		.h = h,
+		.tform = t,
+		.fmt = fmt,
+		.refs = 1,
+		.stream = n < a->nframes,
+		.anim = a,
+		.mem.size = n * fsize,
+		.nslots = n,
+		.slots = xcalloc(n, sizeof(struct slot)),
+	};
+
+	if ((mfd = memfd_create("ewd-ring", 0)) == -1) {
+		warn("memfd_create");
+		goto err;
+	}
+	if (ftruncate(mfd, r->mem.size) == -1) {
+		warn("ftruncate");
+		goto err;
+	}
+	if ((r->mem.p = mmap(NULL, r->mem.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                     mfd, 0))
+	    == MAP_FAILED)
+	{
+		warn("mmap");
+		goto err;
+	}
+	if (!(pool = wl_shm_create_pool(shm, mfd, r->mem.size))) {
+		warnx("Failed to create shm pool");
+		goto err;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		struct slot *s = r->slots + i;
+		s->frame = UINT32_MAX;
+		s->p = r->mem.p + i * fsize;
+		s->ring = r;
+		s->wl_buf = wl_shm_pool_create_buffer(pool, i * fsize, w, h,
+		                                      w * fmt_bpp(fmt), fmt);
+		wl_buffer_add_listener(s->wl_buf, &slot_listener, s);
+	}
+	wl_shm_pool_destroy(pool);
+	close(mfd);
+
+	a->refs++;
+	da_append(&a->rings, r);
+	return r;
+
+err:
+	if (mfd != -1)
+		close(mfd);
+	if (r->mem.p && r->mem.p != MAP_FAILED)
+		munmap(r->mem.p, r->mem.size);
+	free(r->slots);
+	free(r);
+	return NULL;
+}
+
+void
+ring_release(struct ring *r)
+{
+	struct anim *a = r->anim;
+
+	if (--r->refs > 0)
+		return;
+
+	for (size_t i = 0; i < a->rings.len; i++) {
+		if (a->rings.buf[i] == r) {
+			da_remove(&a->rings, i);
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < r->nslots; i++)
+		wl_buffer_destroy(r->slots[i].wl_buf);
+	munmap(r->mem.p, r->mem.size);
+	free(r->slots);
+	free(r);
+	anim_unref(a);
+}
+
+/* Get the slot holding the given frame, scaling it into the slot with the
+   given filter first if it isn’t already there or was scaled with a cheaper
+   filter.  NULL is returned if the slot that the frame maps to is still in use
+   by the compositor.  A frame still in use that was scaled with a cheaper
+   filter is returned as is, and scaled anew once the compositor releases it. */
+struct slot *
+ring_frame(struct ring *r, u32 frame, enum filter f)
+{
+	struct slot *s = r->slots + frame % r->nslots;
+
+	if (s->frame != frame || s->filter > f) {
+		if (s->busy) {
+			if (s->frame != frame)
+				return NULL;
+			s->want = MIN(s->want, f);
+			return s;
+		}
+		slot_scale(s, frame, f);
+	}
+	return s;
+}
+
+void
+slot_scale(struct slot *s, u32 frame, enum filter f)
+{
+	struct ring *r = s->ring;
+	struct anim *a = r->anim;
+	size_t fsize = (size_t)a->w * a->h * sizeof(xrgb);
+
+	scale(s->p, r->w, r->h, r->fmt, r->tform, a->src.p + frame * fsize, a->w,
+	      a->h, NULL, f);
+	s->frame = frame;
+	s->filter = s->want = f;
+}
+
+void
+slot_free(void *data, wl_buffer_t *wl_buf)
+{
+	struct slot *s = data;
+
+	s->busy = false;
+	if (s->want < s->filter)
+		slot_scale(s, s->frame, s->want);
+}
@@ -0,0 +1,73 @@
+#ifndef EWD_ANIM_H
+#define EWD_ANIM_H
+
+#include <stddef.h>
+
+#include "common.h"
+#include "scale.h"
+#include "types.h"
+
+/* Minimum number of slots in a streaming ring: one frame on screen, one that
+   the compositor may still be holding onto, and one being scaled ahead */
+#define RING_MIN 3
+
+/* A single scaled frame in a ring */
+struct slot {
+	u32 frame;          /* Index of the frame held, or UINT32_MAX if empty */
+	bool busy;          /* Attached and not yet released by the compositor? */
+	enum filter filter; /* Filter the frame was scaled with */
+	enum filter want;   /* Filter to rescale with once released */
+	u8 *p;              /* Pixel data within the rings shared memory */
+	wl_buffer_t *wl_buf;
+	struct ring *ring;  /* Ring the slot belongs to */
+};
+
+/* The frames of an animation scaled to a single output size.  If every frame
+   fits within the memory cap then the ring holds each frame and every frame is
+   scaled exactly once.  Otherwise the ring streams; frame ‘i’ lives in slot
+   ‘i % nslots’ and is rescaled whenever playback comes back around to it. */
+struct ring {
+	u32 w, h;       /* Dimensions of each scaled frame */
+	u32 tform;      /* Output transform the frames are drawn with */
+	u32 fmt;        /* wl_shm format of the frames */
+	u32 refs;       /* Number of outputs playing from this ring */
+	bool stream;    /* Are there fewer slots than frames? */
+	struct anim *anim;
+
+	struct {
+		u8 *p;
+		size_t size;
+	} mem;
+
+	size_t nslots;
+	struct slot *slots;
+};
+
+/* A decoded animation as received from a client */
+struct anim {
+	u32 w, h;    /* Source dimensions */
+	u32 nframes; /* Number of frames */
+	u32 *durs;   /* Per-frame durations in milliseconds */
+	u32 refs;    /* Number of outputs playing this animation */
+
+	struct {
+		u8 *p;
+		size_t size;
+	} src;
+
+	struct {
+		struct ring **buf;
+		size_t len, cap;
+	} rings;
+};
+
+struct anim *anim_new(u8 *, size_t, u32, u32, u32, u32 *);
+struct anim *anim_ref(struct anim *);
+void anim_unref(struct anim *);
+
+struct ring *ring_acquire(struct anim *, wl_shm_t *, u32, u32, u32, u32,
+                          size_t);
+void ring_release(struct ring *);
+struct slot *ring_frame(struct ring *, u32, enum filter);
+
+#endif /* !EWD_ANIM_H */
@@ -0,0 +1,365 @@
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <wayland-client-protocol.h>
+
+#include "bcache.h"
+#include "common.h"
+#include "da.h"
+#include "scale.h"
+
+/* Primes of XXH64 */
+#define P1 0x9E3779B185EBCA87
+#define P2 0xC2B2AE3D27D4EB4F
+#define P3 0x165667B19E3779F9
+#define P4 0x85EBCA77C2B2AE63
+
+#define ROTL(x, n) ((x) << (n) | (x) >> (64 - (n)))
+
+static void sbuf_free(struct sbuf *);
+static void sbuf_release(void *, wl_buffer_t *);
+static void *sjob_thrd(void *);
+static void evict(void);
+static bool place_eq(const struct sbuf *, const struct place *);
+
+static const wl_buffer_listener_t sbuf_listener = {
+	.release = sbuf_release,
+};
+
+static struct {
+	struct sbuf **buf;
+	size_t len, cap;
+} bufs;
+
+static size_t cap;   /* Memory budget (bytes) */
+static size_t used;  /* Memory used by all buffers (bytes) */
+static u64 now;      /* Number of lookups so far */
+static u64 hits, misses, evictions, recycled;
+
+void
+bcache_init(size_t n)
+{
+	cap = n;
+	da_init(&bufs, 8);
+}
+
+void
+bcache_free(void)
+{
+	da_foreach (&bufs, b)
+		sbuf_free(*b);
+	free(bufs.buf);
+}
+
+/* Look up the image with content hash ‘hash’ scaled from ‘sw’×‘sh’ to ‘w’×‘h’
+   for the output transform ‘t’ in the wl_shm format ‘fmt’ with the given
+   placement and filter.  The caller holds a reference to the returned buffer
+   until it calls bcache_put(), if it’s in the cache at all. */
+struct sbuf *
+bcache_find(u64 hash, u32 sw, u32 sh, u32 w, u32 h, u32 t, u32 fmt,
+            const struct place *pl, enum filter f)
+{
+	now++;
+	da_foreach (&bufs, p) {
+		struct sbuf *b = *p;
+		if (b->hash == hash && b->sw == sw && b->sh == sh && b->w == w
+		    && b->h == h && b->tform == t && b->fmt == fmt && b->filter == f
+		    && place_eq(b, pl))
+		{
+			b->refs++;
+			b->used = now;
+			return b;
+		}
+	}
+	return NULL;
+}
+
+/* Get the image ‘src’ with content hash ‘hash’ scaled from ‘sw’×‘sh’ to
+   ‘w’×‘h’ for the output transform ‘t’ in the wl_shm format ‘fmt’ with the
+   given placement and filter, only scaling it if it’s not in the cache
+   already.  The caller holds a reference to the returned buffer until it
+   calls bcache_put(). */
+struct sbuf *
+bcache_get(wl_shm_t *shm, const u8 *src, u64 hash, u32 sw, u32 sh, u32 w,
+           u32 h, u32 t, u32 fmt, const struct place *pl, enum filter f)
+{
+	struct sbuf *b;
+
+	/* A buffer scaled ahead of time by bcache_scale() was scaled for this
+	   very lookup, so its first lookup is still a miss */
+	if ((b = bcache_find(hash, sw, sh, w, h, t, fmt, pl, f))) {
+		if (b->fresh)
+			misses++;
+		else
+			hits++;
+		b->fresh = false;
+		return b;
+	}
+	misses++;
+	if ((b = bcache_new(shm, hash, sw, sh, w, h, t, fmt, pl, f)))
+		scale(b->p, w, h, fmt, t, src, sw, sh, pl, f);
+	return b;
+}
+
+/* Add a ‘w’×‘h’ buffer to the cache under the given key for the caller to fill
+   in, which must not already be in the cache.  If the new buffer would push
+   the cache over budget we reuse the least recently used buffer of the same
+   size that nobody holds onto instead of mapping a new one and evicting. */
+struct sbuf *
+bcache_new(wl_shm_t *shm, u64 hash, u32 sw, u32 sh, u32 w, u32 h, u32 t,
+           u32 fmt, const struct place *pl, enum filter f)
+{
+	int mfd;
+	struct sbuf *b = NULL;
+	wl_shm_pool_t *pool;
+
+	if (used + (size_t)w * h * fmt_bpp(fmt) > cap) {
+		da_foreach (&bufs, p) {
+			if (!(*p)->refs && !(*p)->busy && (*p)->w == w && (*p)->h == h
+			    && (*p)->fmt == fmt && (!b || (*p)->used < b->used))
+			{
+				b = *p;
+			}
+		}
+	}
+	if (b) {
+		recycled++;
+		b->hash = hash;
+		b->sw = sw;
+		b->sh = sh;
+		b->tform = t;
+		b->filter = f;
+		b->placed = pl;
+		b->place = pl ? *pl : (struct place){0};
+		b->refs = 1;
+		b->fresh = false;
+		b->used = now;
+		return b;
+	}
+
+	b = xmalloc(sizeof(*b));
+	*b = (struct sbuf){
+		.hash = hash,
+		.sw = sw,
+		.sh = sh,
+		.w = w,
+		.h = h,
+		.tform = t,
+		.fmt = fmt,
+		.placed = pl,
+		.place = pl ? *pl : (struct place){0},
+		.filter = f,
+		.refs = 1,
+		.used = now,
+		.p = MAP_FAILED,
+		.size = (size_t)w * h * fmt_bpp(fmt),
+	};
+
+	if ((mfd = memfd_create("ewd-shm", 0)) == -1) {
+		warn("memfd_create");
+		goto err;
+	}
+	if (ftruncate(mfd, b->size) == -1) {
+		warn("ftruncate");
+		goto err;
+	}
+	if ((b->p = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_SHARED, mfd,
+	                 0))
+	    == MAP_FAILED)
+	{
+		warn("mmap");
+		goto err;
+	}
+	if (!(pool = wl_shm_create_pool(shm, mfd, b->size))) {
+		warnx("Failed to create shm pool");
+		goto err;
+	}
+	b->wl_buf = wl_shm_pool_create_buffer(pool, 0, w, h, w * fmt_bpp(fmt),
+	                                      fmt);
+	wl_shm_pool_destroy(pool);
+	if (!b->wl_buf) {
+		warnx("Failed to create shm pool buffer");
+		goto err;
+	}
+	wl_buffer_add_listener(b->wl_buf, &sbuf_listener, b);
+	close(mfd);
+
+	da_append(&bufs, b);
+	used += b->size;
+	evict();
+	return b;
+
+err:
+	if (mfd != -1)
+		close(mfd);
+	if (b->p != MAP_FAILED)
+		munmap(b->p, b->size);
+	free(b);
+	return NULL;
+}
+
+void
+bcache_put(struct sbuf *b)
+{
+	b->refs--;
+	evict();
+}
+
+/* Copy the ‘w’×‘h’ rectangle at ‘x’,‘y’ from ‘src’ to ‘dst’, which must be
+   buffers of the same size and format */
+void
+bcache_copy(struct sbuf *dst, const struct sbuf *src, u32 x, u32 y, u32 w,
+            u32 h)
+{
+	size_t bpp = fmt_bpp(src->fmt);
+	size_t stride = src->w * bpp;
+
+	for (size_t i = y; i < (size_t)y + h; i++)
+		memcpy(dst->p + i * stride + x * bpp, src->p + i * stride + x * bpp,
+		       w * bpp);
+}
+
+/* Scale a batch of buffers, each on its own thread.  This lets all the outputs
+   that changed at once be scaled in the time it takes to scale the largest
+   one rather than in the time it takes to scale them all. */
+void
+bcache_scale(struct sjob *jobs, size_t n)
+{
+	pthread_t *thrds;
+	bool *async;
+
+	if (n == 0)
+		return;
+	thrds = xcalloc(n, sizeof(*thrds));
+	async = xcalloc(n, sizeof(*async));
+
+	for (size_t i = 1; i < n; i++) {
+		if ((errno = pthread_create(thrds + i, NULL, sjob_thrd, jobs + i)))
+			warn("pthread_create");
+		else
+			async[i] = true;
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (!async[i])
+			sjob_thrd(jobs + i);
+	}
+	for (size_t i = 1; i < n; i++) {
+		if (async[i] && (errno = pthread_join(thrds[i], NULL)))
+			die("pthread_join");
+	}
+
+	free(thrds);
+	free(async);
+}
+
+/* Write the cache statistics as a single line */
+void
+bcache_print(int fd)
+{
+	dprintf(fd,
+	        "buffers hits=%" PRIu64 " misses=%" PRIu64 " evictions=%" PRIu64
+	        " recycled=%" PRIu64 " count=%zu size=%zu cap=%zu\n",
+	        hits, misses, evictions, recycled, bufs.len, used, cap);
+}
+
+/* A quick non-cryptographic hash along the lines of XXH64, with four
+   independent lanes so that the multiplications overlap.  It only needs to
+   tell apart the images sent to us, and it runs at close to memory bandwidth
+   which is far cheaper than scaling. */
+u64
+bcache_hash(const u8 *p, size_t n)
+{
+	size_t i = 0;
+	u64 h, w, v[4] = {P1 + P2, P2, 0, -P1};
+
+	for (; i + 32 <= n; i += 32) {
+		for (int j = 0; j < 4; j++) {
+			memcpy(&w, p + i + j * 8, sizeof(w));
+			v[j] = ROTL(v[j] + w * P2, 31) * P1;
+		}
+	}
+
+	h = ROTL(v[0], 1) + ROTL(v[1], 7) + ROTL(v[2], 12) + ROTL(v[3], 18) + n;
+	for (; i < n; i++)
+		h = ROTL(h ^ (p[i] * P4), 11) * P1;
+
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
+
+/* Free the least recently used buffers until we’re within budget again.
+   Buffers that are on screen or that the compositor still holds onto are
+   kept no matter what. */
+void
+evict(void)
+{
+	while (used > cap) {
+		size_t lru = SIZE_MAX;
+
+		for (size_t i = 0; i < bufs.len; i++) {
+			struct sbuf *b = bufs.buf[i];
+			if (!b->refs && !b->busy
+			    && (lru == SIZE_MAX || b->used < bufs.buf[lru]->used))
+			{
+				lru = i;
+			}
+		}
+		if (lru == SIZE_MAX)
+			break;
+
+		sbuf_free(bufs.buf[lru]);
+		da_remove(&bufs, lru);
+		evictions++;
+	}
+}
+
+bool
+place_eq(const struct sbuf *b, const struct place *pl)
+{
+	if (!pl)
+		return !b->placed;
+	return b->placed && b->place.x == pl->x && b->place.y == pl->y
+	    && b->place.w == pl->w && b->place.h == pl->h
+	    && b->place.tile == pl->tile && b->place.bg == pl->bg;
+}
+
+void
+sbuf_free(struct sbuf *b)
+{
+	used -= b->size;
+	wl_buffer_destroy(b->wl_buf);
+	munmap(b->p, b->size);
+	free(b);
+}
+
+void *
+sjob_thrd(void *arg)
+{
+	struct sjob *j = arg;
+	struct sbuf *b = j->b;
+
+	scale(b->p, b->w, b->h, b->fmt, b->tform, j->src, b->sw, b->sh,
+	      b->placed ? &b->place : NULL, b->filter);
+	b->fresh = true;
+	return NULL;
+}
+
+void
+sbuf_release(void *data, wl_buffer_t *wl_buf)
+{
+	((struct sbuf *)data)->busy = false;
+	evict();
+}
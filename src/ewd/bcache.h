@@ -0,0 +1,52 @@
+#ifndef EWD_BCACHE_H
+#define EWD_BCACHE_H
+
+#include <stddef.h>
+
+#include "common.h"
+#include "scale.h"
+#include "types.h"
+
+/* A still image scaled to the size of an output.  Buffers are never written
+   to once scaled, so every output of the same size showing the same image
+   shares one, and they stick around after they stop being shown in case the
+   image comes back. */
+struct sbuf {
+	u64 hash;           /* Content hash of the source image */
+	u32 sw, sh;         /* Source dimensions */
+	u32 w, h;           /* Scaled dimensions */
+	u32 tform;          /* Output transform the image was drawn with */
+	u32 fmt;            /* wl_shm format of the buffer */
+	bool placed;        /* Scaled only the region ‘place’ of the image? */
+	struct place place;
+	enum filter filter; /* Filter the image was scaled with */
+	u32 refs;           /* Number of outputs showing this buffer */
+	bool busy;          /* Attached and not yet released by the compositor? */
+	bool fresh;         /* Scaled ahead of time and not yet looked up? */
+	u64 used;           /* Time of last use, in cache lookups */
+	u8 *p;
+	size_t size;
+	wl_buffer_t *wl_buf;
+};
+
+/* A buffer from bcache_new() to be scaled from ‘src’ by bcache_scale() */
+struct sjob {
+	struct sbuf *b;
+	const u8 *src;
+};
+
+void bcache_init(size_t);
+void bcache_free(void);
+void bcache_copy(struct sbuf *, const struct sbuf *, u32, u32, u32, u32);
+struct sbuf *bcache_find(u64, u32, u32, u32, u32, u32, u32,
+                         const struct place *, enum filter);
+struct sbuf *bcache_get(wl_shm_t *, const u8 *, u64, u32, u32, u32, u32, u32,
+                        u32, const struct place *, enum filter);
+u64 bcache_hash(const u8 *, size_t);
+struct sbuf *bcache_new(wl_shm_t *, u64, u32, u32, u32, u32, u32, u32,
+                        const struct place *, enum filter);
+void bcache_print(int);
+void bcache_put(struct sbuf *);
+void bcache_scale(struct sjob *, size_t);
+
+#endif /* !EWD_BCACHE_H */
@@ -0,0 +1,57 @@
+#include <sys/param.h>
+
+#include "common.h"
+#include "gov.h"
+#include "scale.h"
+
+/* A frame is over budget if the average render time exceeds GOV_HIGH percent
+   of the budget, and has headroom if it’s below GOV_LOW percent */
+#define GOV_HIGH 75
+#define GOV_LOW  25
+
+/* Number of consecutive frames over budget before stepping down a tier, and
+   with headroom before stepping back up.  Stepping up is deliberately slow so
+   that we don’t flip-flop between two tiers. */
+#define GOV_DOWN 4
+#define GOV_UP   60
+
+/* Record that a frame took ‘t’ nanoseconds to render on an output with a
+   refresh interval of ‘refresh’ nanoseconds, and return whether or not the
+   tier changed as a result */
+bool
+gov_update(struct gov *g, u64 t, u64 refresh)
+{
+	/* At half the frame rate we have twice the time to render each frame */
+	g->budget = g->tier >= TIER_HALFRATE ? refresh * 2 : refresh;
+
+	/* Exponential moving average with a weight of 1/8 */
+	g->avg = g->avg ? g->avg - g->avg / 8 + t / 8 : t;
+
+	if (g->avg * 100 > g->budget * GOV_HIGH)
+		g->streak = MAX(g->streak, 0) + 1;
+	else if (g->avg * 100 < g->budget * GOV_LOW)
+		g->streak = MIN(g->streak, 0) - 1;
+	else
+		g->streak = 0;
+
+	if (g->streak >= GOV_DOWN && g->tier < TIER_NEAREST)
+		g->tier++;
+	else if (g->streak <= -GOV_UP && g->tier > TIER_FULL)
+		g->tier--;
+	else
+		return false;
+
+	/* Start measuring afresh in the new tier */
+	g->avg = 0;
+	g->streak = 0;
+	g->changes++;
+	return true;
+}
+
+enum filter
+gov_filter(const struct gov *g)
+{
+	return g->tier >= TIER_NEAREST  ? FILTER_NEAREST
+	     : g->tier >= TIER_BILINEAR ? FILTER_BILINEAR
+	                                : FILTER_BEST;
+}
@@ -0,0 +1,31 @@
+#ifndef EWD_GOV_H
+#define EWD_GOV_H
+
+#include "common.h"
+#include "scale.h"
+
+/* Quality tiers, from best to cheapest.  Each tier includes all of the
+   degradations of the tiers before it. */
+enum tier {
+	TIER_FULL,      /* Every frame, best filter, full resolution */
+	TIER_HALFRATE,  /* Draw on every other frame callback */
+	TIER_BILINEAR,  /* Scale with a bilinear filter */
+	TIER_HALFRES,   /* Render at half resolution and upscale via viewport */
+	TIER_NEAREST,   /* Scale with nearest-neighbour sampling */
+};
+
+/* A governor tracking how long frames take to render compared to the refresh
+   interval of an output, stepping down through the quality tiers when
+   rendering can’t keep up and back up again once there is headroom */
+struct gov {
+	enum tier tier;
+	u64 avg;     /* Moving average of the render time (ns) */
+	u64 budget;  /* Time budget of the last frame (ns) */
+	i32 streak;  /* Consecutive frames over (> 0) or under (< 0) budget */
+	u64 changes; /* Number of tier changes */
+};
+
+bool gov_update(struct gov *, u64, u64);
+enum filter gov_filter(const struct gov *);
+
+#endif /* !EWD_GOV_H */
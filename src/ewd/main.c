@@ -1,11 +1,14 @@
 #include <sys/mman.h>
+#include <sys/param.h>
 #include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/uio.h>
 #include <sys/un.h>
 
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
 #include <poll.h>
@@ -13,43 +16,284 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <wayland-client-core.h>
 #include <wayland-client-protocol.h>
 #include <wayland-util.h>
 
+#include "anim.h"
+#include "bcache.h"
 #include "common.h"
 #include "da.h"
+#include "gov.h"
 #include "scale.h"
+#include "stats.h"
 #include "types.h"
+#include "zbuf.h"
 
+#include "proto/ext-idle-notify-v1.h"
+#include "proto/fractional-scale-v1.h"
+#include "proto/presentation-time.h"
+#include "proto/viewporter.h"
 #include "proto/wlr-layer-shell-unstable-v1.h"
+#include "proto/wlr-output-power-management-unstable-v1.h"
 
 #define SOCK_BACKLOG 128
 
+/* Maximum number of in-flight presentation feedback requests per output */
+#define PENDING_MAX 4
+
+/* Convert milliseconds to nanoseconds */
+#define MS(x) ((u64)(x) * 1000000)
+
+/* Refresh interval assumed for outputs that don’t advertise one */
+#define REFRESH_DEFAULT 16666667
+
+/* Default number of seconds without user activity before the session is
+   considered idle */
+#define IDLE_DEFAULT 300
+
+/* Maximum zoom of a view, in percent.  The buffer of a zoomed image grows
+   with the square of the zoom. */
+#define VIEW_ZOOM_MAX 400
+
+/* Default cap on the memory used by each ring of scaled animation frames */
+#define RING_CAP_DEFAULT ((size_t)256 << 20)
+
+/* Default cap on the memory used by scaled still images */
+#define BCACHE_CAP_DEFAULT ((size_t)256 << 20)
+
+/* Default cap on the memory used by preloaded images */
+#define PRELOAD_CAP_DEFAULT ((size_t)512 << 20)
+
+/* Time to wait after the last configuration change of an output before
+   acting on it */
+#define SETTLE_DELAY MS(50)
+
+/* Number of patched rectangles we keep track of before merging them into one
+   covering them all */
+#define UPD_STALE_MAX 16
+
+/* A view of an image zoomed in by a factor of ‘z’ and panned to ‘x’ and ‘y’,
+   each given as a fraction of the area left over to pan around in */
+struct view {
+	double x, y, z;
+};
+
+/* A preloaded image scaled to one output size.  The scaled buffer is held
+   onto until the background thread has compressed it, after which it’s left
+   to the buffer cache and decompressed again if it gets evicted. */
+struct pbuf {
+	struct preload *p; /* Owner, or NULL if unloaded while compressing */
+	struct sbuf *b;    /* Scaled buffer, until it’s been compressed */
+	struct zbuf *z;    /* Compressed copy of the scaled buffer */
+	struct zjob *job;  /* Compression in progress */
+	u32 tform;         /* Output transform the buffer was drawn with */
+	u32 fmt;           /* wl_shm format of the buffer */
+};
+
+/* An image registered ahead of time to be shown later, along with its
+   buffers scaled to each output size at the time it was preloaded */
+struct preload {
+	u32 id;
+	int fd;     /* Memfd of the image */
+	u32 w, h;   /* Image dimensions */
+	u64 hash;   /* Content hash of the image */
+	u8 *src;
+	size_t mem; /* Memory used by the image and its buffers */
+	struct {
+		struct pbuf **buf;
+		size_t len, cap;
+	} bufs;
+};
+
+/* A buffer format requested for a display, or for all displays if ‘name’ is
+   NULL */
+struct fmtopt {
+	char *name;
+	u32 fmt;
+};
+
+/* How a still image is laid out: placed on each output as the EWD_PLACE_*
+   mode ‘mode’ says, with the colour ‘bg’ wherever it doesn’t cover, or placed
+   like that on all outputs together as one if ‘span’ is set */
+struct layout {
+	u32 mode;
+	xrgb bg;
+	bool span;
+};
+
+/* The last image set on a display, or on all displays if ‘name’ is NULL.  We
+   remember these so that displays plugged in later get the image too. */
+struct target {
+	char *name;
+	int fd;            /* Memfd of a still image, or -1 */
+	u32 w, h;          /* Dimensions of the still image */
+	u64 hash;          /* Content hash of the still image */
+	struct layout lay; /* Layout of the still image */
+	struct anim *anim; /* Animation, or NULL */
+};
+
+/* A layer drawn over the still image of an output, which is mapped at ‘map’
+   if it has an image */
+struct layer {
+	u32 id; /* Layers are drawn in order of increasing ID */
+	struct overlay ov;
+	u8 *map;
+	size_t size;
+};
+
 struct output {
 	u32 name;          /* Wayland output name */
 	bool safe_to_draw; /* Safe to draw new frame? */
 	char *human_name;  /* Human-readable name (e.g. ‘eDP-1’) */
 
-	/* Display- and image dimensions */
+	/* Display- and image dimensions.  The display dimensions are in pixels,
+	   which on a scaled output differ from the size of the surface given to
+	   us by the compositor. */
 	u32 iw, ih;
 	u32 dw, dh;
 
+	/* Surface size, the integer scale of the output and the preferred
+	   fractional scale of the surface in 120ths, or 0 if we don’t know it.
+	   A fractional scale can only be honoured with a viewport. */
+	u32 lw, lh;
+	u32 iscale;
+	u32 fscale;
+	wp_fractional_scale_v1_t *fs;
+
+	/* Position of the output in the compositor’s layout, which images
+	   spanning all outputs are laid out by */
+	i32 x, y;
+
+	/* Transform of the output.  Buffers are drawn in the orientation of the
+	   panel itself so that the compositor doesn’t need to rotate them, which
+	   means that their width and height are swapped on rotated outputs. */
+	u32 tform;
+
+	/* Format of the buffers, which on memory constrained machines may be a
+	   16-bit format */
+	u32 fmt;
+
+	/* Memfd of the current image, kept around to rescale it later, or -1,
+	   the content hash of the image and how it’s laid out */
+	int ifd;
+	u64 ihash;
+	struct layout lay;
+
+	/* Scaled current image */
+	struct sbuf *buf;
+
+	/* Patches drawn over the current image by update messages.  Buffers from
+	   the cache may be shared, so the first update copies the image into a
+	   buffer of our own.  From then on we flip between that and a second
+	   buffer, bringing the one we flip to up to date by copying only the
+	   rectangles patched since it was last shown. */
+	struct {
+		bool own;          /* Is ‘buf’ our own rather than shared? */
+		struct sbuf *back; /* Our other buffer, or NULL */
+		struct {
+			struct rect *buf;
+			size_t len, cap;
+		} stale; /* Rectangles of ‘buf’ patched since ‘back’ was shown */
+	} upd;
+
+	/* Layers drawn over the still image, lowest first.  While they are
+	   shown the scaled image is kept aside as their base, and the current
+	   buffer is one of our own holding the image with the layers composed
+	   over it.  A change to a layer composes only the area it covers again,
+	   and the image is never scaled again for it. */
+	struct {
+		struct sbuf *base; /* Image without layers, or NULL */
+		bool own;          /* Is ‘base’ our own rather than shared? */
+		struct {
+			struct layer *buf;
+			size_t len, cap;
+		} layers;
+	} lyr;
+
+	/* Changes to the configuration of an output tend to come in bursts, such
+	   as when docking a laptop.  Rather than acting on each of them we wait
+	   for things to settle and then bring every output up to date at once. */
+	struct {
+		bool dirty;   /* Configured since we last caught up? */
+		bool resized; /* Changed size since we last caught up? */
+		bool partial; /* Output changed without a done event yet? */
+	} conf;
+
+	/* Pan and zoom of a static image.  Rather than rescaling the image every
+	   frame, it is scaled once into a buffer ‘scale’ percent the size of the
+	   output and we only move the source rectangle of the viewport about. */
 	struct {
-		u8 *p;
-		size_t size;
-	} buf;
+		u32 scale;      /* Size of the buffer relative to the output (%) */
+		bool moving;    /* Still moving towards ‘to’? */
+		bool bounce;    /* Move back and forth between ‘from’ and ‘to’? */
+		u64 start, dur; /* Start time and duration of the movement (ns) */
+		struct view from, to, cur;
+		wl_callback_t *cb;
+	} view;
+
+	/* Animation playback state */
+	struct {
+		struct ring *ring;
+		u32 frame;       /* Frame currently on screen */
+		u64 next;        /* Time at which to show the next frame (ns) */
+		bool started;    /* Has ‘next’ been set yet? */
+		bool skip;       /* Skip the next frame callback at half rate? */
+		wl_callback_t *cb;
+	} anim;
+
+	/* Rendering quality of animations */
+	struct gov gov;
+
+	/* While an output is powered off or the session is idle nobody can see
+	   the wallpaper, so animations are paused and rescales are put off until
+	   the output wakes up again */
+	struct {
+		bool off;     /* Powered off? */
+		bool paused;  /* Animation paused until we wake up? */
+		u64 since;    /* Time at which the animation was paused (ns) */
+		u64 skipped;  /* Animation frames not rendered while asleep */
+		u64 deferred; /* Rescales put off until we woke up */
+		bool pending; /* Image waiting to be scaled? */
+		zwlr_output_power_v1_t *power;
+	} sleep;
+
+	/* Presentation feedback and frame pacing statistics.  Times are in
+	   nanoseconds in the presentation clock domain. */
+	struct {
+		u64 last;    /* Time at which the last frame was presented */
+		u32 refresh; /* Refresh interval, or 0 if unknown */
+		u64 presented, discarded, dropped;
+
+		struct hist interval; /* Present-to-present interval (ms) */
+		struct hist missed;   /* Vblanks missed per frame */
+		struct hist latency;  /* Render-to-present latency (ms) */
+
+		struct pending {
+			wp_presentation_feedback_t *fb;
+			u64 start;  /* Time at which rendering started */
+			u64 target; /* Time at which we expected presentation */
+		} pending[PENDING_MAX];
+	} pace;
 
-	wl_buffer_t *wl_buf;
 	wl_output_t *wl_out;
 	wl_surface_t *surf;
+	wp_viewport_t *vp;
 	zwlr_layer_surface_v1_t *layer;
 };
 
 /* Wayland listener event handlers */
-static void buf_free(void *, wl_buffer_t *);
+static void fb_discarded(void *, wp_presentation_feedback_t *);
+static void fb_presented(void *, wp_presentation_feedback_t *, u32, u32, u32,
+                         u32, u32, u32, u32);
+static void fb_sync(void *, wp_presentation_feedback_t *, wl_output_t *);
+static void frac_scale(void *, wp_fractional_scale_v1_t *, u32);
+static void frame_done(void *, wl_callback_t *, u32);
+static void idle_idled(void *, ext_idle_notification_v1_t *);
+static void idle_resumed(void *, ext_idle_notification_v1_t *);
 static void ls_close(void *, zwlr_layer_surface_v1_t *);
 static void ls_conf(void *, zwlr_layer_surface_v1_t *, u32, u32, u32);
 static void out_desc(void *, wl_output_t *, const char *);
@@ -59,23 +303,108 @@ static void out_geom(void *, wl_output_t *, i32, i32, i32, i32, i32,
 static void out_mode(void *, wl_output_t *, u32, i32, i32, i32);
 static void out_name(void *, wl_output_t *, const char *);
 static void out_scale(void *, wl_output_t *, i32);
+static void power_failed(void *, zwlr_output_power_v1_t *);
+static void power_mode(void *, zwlr_output_power_v1_t *, u32);
+static void pres_clock_id(void *, wp_presentation_t *, u32);
 static void reg_add(void *, wl_registry_t *, u32, const char *, u32);
 static void reg_del(void *, wl_registry_t *, u32);
 static void shm_fmt(void *, wl_shm_t *, u32);
+static void view_done(void *, wl_callback_t *, u32);
 
 /* Normal functions */
+static void anim_draw(struct output *, u64);
+static void anim_start(struct output *, struct anim *);
+static void anim_stop(struct output *);
+static void anim_tier(struct output *);
+static void anim_wait(struct output *);
 static void cleanup(void);
 static void clear(struct output *);
 static void draw(struct output *);
-static bool mkbuf(struct output *, u8 *, u32, u32);
+static void idle_init(void);
+static void lyr_compose(struct output *, const struct rect *, size_t);
+static struct rect lyr_compose_into(struct output *, struct sbuf *,
+                                    struct rect);
+static void lyr_free(struct output *);
+static void lyr_set(struct output *, u32, struct overlay, u8 *, size_t);
+static bool lyr_shown(struct output *);
+static bool lyr_start(struct output *);
+static void lyr_stop(struct output *);
+static bool mkbuf(struct output *, u8 *);
+static bool msg_outputs(int);
+static bool msg_preload(int, int);
+static bool msg_set(int, int);
+static bool msg_show(int);
+static bool msg_stats(int);
+static bool msg_unload(int);
+static bool msg_layer(int, int);
+static bool msg_update(int, int);
+static bool msg_view(int);
+static bool out_asleep(struct output *);
+static void out_bufsize(struct output *, u32 *, u32 *);
+static bool out_clip(struct output *, struct rect *);
+static bool out_flip(struct output *);
+static u32 out_format(struct output *);
+static void out_fit(struct output *, u32, u32);
 static void out_layer_free(struct output *);
+static void out_free(struct output *);
+static void out_orient(struct output *, u32 *, u32 *);
+static const struct place *out_place(struct output *, const struct layout *,
+                                     u32, u32, struct place *);
+static void out_power(struct output *);
+static struct sbuf *out_prescale(struct output *, const struct layout *, u64,
+                                 u32, u32);
+static void out_resize(struct output *);
+static void out_restore(struct output *, bool);
+static void out_settle(void);
+static bool out_show(struct output *, int, u8 *, u32, u32, u64,
+                     const struct layout *);
+static void out_sleep(struct output *);
+static void out_stale(struct output *, struct rect);
+static void out_unset(struct output *);
+static void out_update(struct output *, const u8 *, u32, struct rect);
+static void out_wake(struct output *);
+static void pace_feedback(struct output *, u64, u64);
+static u64 pace_now(void);
+static bool pace_pop(struct output *, wp_presentation_feedback_t *,
+                     struct pending *);
+static u64 pace_predict(struct output *);
+static struct sbuf *preload_buf(struct preload *, struct output *);
+static struct preload *preload_find(u32);
+static void preload_free(struct preload *);
+static void preload_zdone(void);
+static bool img_size(u32, u32, u32, size_t *);
+static u8 *map_image(int, size_t);
+static bool readall(int, void *, size_t);
+static bool recv_name(int, char **);
+static void rescale(struct output *);
+static bool sock_msg(int);
+static u64 span_off(i32, i32, bool);
 static void surf_create(struct output *);
-
+static void upd_free(struct output *);
+static struct target *target_find(struct output *);
+static void target_free(struct target *);
+static void target_set(const char *, int, u32, u32, u64,
+                       const struct layout *, struct anim *);
+static void view_apply(struct output *);
+static void view_set(struct output *, struct view, u64, bool);
+static void view_stop(struct output *);
+static void view_wait(struct output *);
+
+static ext_idle_notification_v1_t *idle_note;
+static ext_idle_notifier_v1_t *idle_mgr;
 static wl_compositor_t *comp;
 static wl_display_t *disp;
 static wl_registry_t *reg;
+static wl_seat_t *seat;
 static wl_shm_t *shm;
+static wp_fractional_scale_manager_v1_t *fsmgr;
+static wp_presentation_t *pres;
+static wp_viewporter_t *vper;
 static zwlr_layer_shell_v1_t *lshell;
+static zwlr_output_power_manager_v1_t *pmgr;
+
+/* Clock domain of presentation timestamps */
+static clockid_t pres_clock = CLOCK_MONOTONIC;
 
 /* We use this to check in the cleanup routine whether or not we need to unlink
    the daemon’s socket.  Without this check, starting a second daemon while a
@@ -83,13 +412,84 @@ static zwlr_layer_shell_v1_t *lshell;
    unlink the first daemons socket. */
 bool sock_bound = false;
 
+/* Maximum size in bytes of each ring of scaled animation frames */
+static size_t ring_cap = RING_CAP_DEFAULT;
+
+/* Maximum size in bytes of all scaled still images together */
+static size_t bcache_cap = BCACHE_CAP_DEFAULT;
+
+/* Preloaded images, the memory they use and may use in bytes, and the
+   handle of the next one */
+static struct {
+	struct preload **buf;
+	size_t len, cap;
+} preloads;
+static size_t preload_mem, preload_cap = PRELOAD_CAP_DEFAULT;
+static u32 preload_next = 1;
+
+/* Time at which to bring configured outputs up to date, or 0 if none are
+   waiting to be */
+static u64 settle_at;
+
+static struct {
+	struct target *buf;
+	size_t len, cap;
+} targets;
+
+/* Buffer formats that outputs can be given, and whether the compositor
+   supports them.  Every compositor supports XRGB8888. */
+static struct {
+	const char *name;
+	u32 fmt;
+	bool ok;
+} formats[] = {
+	{"xrgb8888",    WL_SHM_FORMAT_XRGB8888,    true },
+	{"rgb565",      WL_SHM_FORMAT_RGB565,      false},
+	{"xrgb2101010", WL_SHM_FORMAT_XRGB2101010, false},
+};
+
+/* Buffer formats requested by the user, later ones taking precedence */
+static struct {
+	struct fmtopt *buf;
+	size_t len, cap;
+} fmtopts;
+
+/* Gaps to leave between neighbouring outputs for their bezels when spanning
+   an image across all outputs, in the units of the compositor’s layout */
+static u32 bezel_x, bezel_y;
+
+/* Seconds of inactivity before the session is idle (0 to never be idle), and
+   whether or not it currently is */
+static u32 idle_timeout = IDLE_DEFAULT;
+static bool idle;
+
+/* Outputs are allocated one by one, as listeners hold on to their addresses */
 static struct {
-	struct output *buf;
+	struct output **buf;
 	size_t len, cap;
 } outputs;
 
-static const wl_buffer_listener_t buf_listener = {
-	.release = buf_free,
+static const wl_callback_listener_t frame_listener = {
+	.done = frame_done,
+};
+
+static const wl_callback_listener_t view_listener = {
+	.done = view_done,
+};
+
+static const ext_idle_notification_v1_listener_t idle_listener = {
+	.idled = idle_idled,
+	.resumed = idle_resumed,
+};
+
+static const wp_fractional_scale_v1_listener_t fs_listener = {
+	.preferred_scale = frac_scale,
+};
+
+static const wp_presentation_feedback_listener_t fb_listener = {
+	.discarded = fb_discarded,
+	.presented = fb_presented,
+	.sync_output = fb_sync,
 };
 
 static const wl_output_listener_t out_listener = {
@@ -101,6 +501,10 @@ static const wl_output_listener_t out_listener = {
 	.scale = out_scale,
 };
 
+static const wp_presentation_listener_t pres_listener = {
+	.clock_id = pres_clock_id,
+};
+
 static const wl_registry_listener_t reg_listener = {
 	.global = reg_add,
 	.global_remove = reg_del,
@@ -115,6 +519,11 @@ static const zwlr_layer_surface_v1_listener_t ls_listener = {
 	.closed = ls_close,
 };
 
+static const zwlr_output_power_v1_listener_t power_listener = {
+	.mode = power_mode,
+	.failed = power_failed,
+};
+
 int
 main(int argc, char **argv)
 {
@@ -123,11 +532,18 @@ main(int argc, char **argv)
 
 	int opt;
 	bool fg = false;
+	char *p;
 	sigset_t mask;
 	struct option longopts[] = {
-		{"foreground", no_argument, 0, 'f'},
-		{"help",       no_argument, 0, 'h'},
-		{NULL,         0,           0, 0  },
+		{"buffer-cache", required_argument, 0, 'b'},
+		{"bezel",        required_argument, 0, 'B'},
+		{"format",       required_argument, 0, 'F'},
+		{"foreground",   no_argument,       0, 'f'},
+		{"help",         no_argument,       0, 'h'},
+		{"idle",         required_argument, 0, 'i'},
+		{"frame-cache",  required_argument, 0, 'm'},
+		{"preload-cap",  required_argument, 0, 'p'},
+		{NULL,           0,                 0, 0  },
 	};
 	struct sockaddr_un saddr = {
 		.sun_family = AF_UNIX,
@@ -136,30 +552,99 @@ main(int argc, char **argv)
 		{.events = POLLIN},
 		{.events = POLLIN},
 		{.events = POLLIN},
+		{.events = POLLIN},
 	};
 	enum {
 		FD_WAY,
 		FD_SIG,
 		FD_SOCK,
+		FD_ZJOB,
 	};
 
 	*argv = basename(*argv);
-	while ((opt = getopt_long(argc, argv, "fh", longopts, NULL)) != -1) {
+	da_init(&fmtopts, 4);
+	while ((opt = getopt_long(argc, argv, "B:b:F:fhi:m:p:", longopts, NULL))
+	       != -1)
+	{
 		switch (opt) {
+		case 'b':
+			errno = 0;
+			bcache_cap = strtoull(optarg, &p, 10) << 20;
+			if (errno || *p || p == optarg)
+				diex("Invalid buffer cache size ‘%s’", optarg);
+			break;
+		case 'B': {
+			char *q = optarg;
+
+			errno = 0;
+			bezel_x = bezel_y = strtoul(q, &p, 10);
+			if (p != q && *p == ',')
+				bezel_y = strtoul(q = p + 1, &p, 10);
+			if (errno || *p || p == q || bezel_x > INT32_MAX
+			    || bezel_y > INT32_MAX)
+			{
+				diex("Invalid bezel size ‘%s’", optarg);
+			}
+			break;
+		}
+		case 'F': {
+			struct fmtopt f = {0};
+			char *fmt = optarg;
+
+			if ((p = strrchr(optarg, ':'))) {
+				if (!(f.name = strndup(optarg, p - optarg)))
+					die("strndup");
+				fmt = p + 1;
+			}
+			for (size_t i = 0; i < lengthof(formats) && !f.fmt; i++) {
+				if (streq(fmt, formats[i].name))
+					f.fmt = formats[i].fmt;
+			}
+			if (!f.fmt)
+				diex("Invalid buffer format ‘%s’", fmt);
+			da_append(&fmtopts, f);
+			break;
+		}
 		case 'f':
 			fg = true;
 			break;
 		case 'h':
 			execlp("man", "man", "1", *argv, NULL);
 			die("execlp: man 1 %s", *argv);
+		case 'i':
+			errno = 0;
+			idle_timeout = strtoul(optarg, &p, 10);
+			if (errno || *p || p == optarg || idle_timeout > UINT32_MAX / 1000)
+				diex("Invalid idle timeout ‘%s’", optarg);
+			break;
+		case 'm':
+			errno = 0;
+			ring_cap = strtoull(optarg, &p, 10) << 20;
+			if (errno || *p || p == optarg)
+				diex("Invalid frame cache size ‘%s’", optarg);
+			break;
+		case 'p':
+			errno = 0;
+			preload_cap = strtoull(optarg, &p, 10) << 20;
+			if (errno || *p || p == optarg)
+				diex("Invalid preload cap ‘%s’", optarg);
+			break;
 		default:
-			fprintf(stderr, "Usage: %s [-f | -h]\n", *argv);
+			fprintf(stderr,
+			        "Usage: %s [-f] [-B width[,height]] [-b size] "
+			        "[-F [display:]format] [-i seconds] [-m size] "
+			        "[-p size]\n"
+			        "       %s -h\n",
+			        *argv, *argv);
 			exit(EXIT_FAILURE);
 		}
 	}
 
 	atexit(cleanup);
 	da_init(&outputs, 8);
+	da_init(&preloads, 8);
+	da_init(&targets, 8);
+	bcache_init(bcache_cap);
 
 	/* Connect to the Wayland display and register all the global objects.  The
 	   first roundtrip doesn’t register any current outputs, so we need to
@@ -188,9 +673,13 @@ main(int argc, char **argv)
 	sigaddset(&mask, SIGQUIT);
 	sigprocmask(SIG_BLOCK, &mask, NULL);
 
+	/* Clients may hang up before reading our reply */
+	signal(SIGPIPE, SIG_IGN);
+
 	FD(WAY) = wl_display_get_fd(disp);
 	if ((FD(SIG) = signalfd(-1, &mask, 0)) == -1)
 		die("signalfd");
+	FD(ZJOB) = zjob_init();
 
 	/* Setup daemon socket */
 	memcpy(saddr.sun_path, ewd_sock_path(), sizeof(saddr.sun_path));
@@ -214,11 +703,18 @@ main(int argc, char **argv)
 		/* Helper macro to check for events (e.g. ‘EVENT(SOCK, POLLIN)’) */
 #define EVENT(x, e) (fds[FD_##x].revents & e)
 
-		int ret;
+		int ret, timeout = -1;
+		u64 now;
+
+		if (settle_at) {
+			now = pace_now();
+			timeout = settle_at > now ? (settle_at - now + MS(1) - 1) / MS(1)
+			                          : 0;
+		}
 
 		wl_display_flush(disp);
 		do
-			ret = poll(fds, lengthof(fds), -1);
+			ret = poll(fds, lengthof(fds), timeout);
 		while (ret == -1 && errno == EINTR);
 		if (ret == -1)
 			die("poll");
@@ -230,80 +726,21 @@ main(int argc, char **argv)
 			if (wl_display_dispatch(disp) == -1)
 				break;
 		} else if (EVENT(SOCK, POLLIN)) {
-			int cfd, mfd;
-			char *name = NULL;
-			size_t nlen;
-			u32 w, h;
-			u8 *src, fdbuf[CMSG_SPACE(sizeof(int))];
-			struct iovec iovs[] = {
-				{.iov_base = &w,    .iov_len = sizeof(w)   },
-				{.iov_base = &h,    .iov_len = sizeof(h)   },
-				{.iov_base = &nlen, .iov_len = sizeof(nlen)},
-			};
-			struct msghdr msg = {
-				.msg_iov = iovs,
-				.msg_iovlen = lengthof(iovs),
-				.msg_control = fdbuf,
-				.msg_controllen = sizeof(fdbuf),
-			};
-			struct cmsghdr *cmsg;
-
-			src = MAP_FAILED;
-			cfd = mfd = -1;
-			if ((cfd = accept(FD(SOCK), NULL, NULL)) == -1) {
+			int cfd;
+			if ((cfd = accept(FD(SOCK), NULL, NULL)) == -1)
 				warn("accept");
-				goto err;
-			}
-			if (recvmsg(cfd, &msg, 0) == -1) {
-				warn("recvmsg");
-				goto err;
-			}
-
-			cmsg = CMSG_FIRSTHDR(&msg);
-			memcpy(&mfd, CMSG_DATA(cmsg), sizeof(mfd));
-
-			if (nlen) {
-				struct iovec iov = {.iov_len = nlen};
-
-				iov.iov_base = name = xmalloc(nlen + 1);
-				if (readv(cfd, &iov, 1) == -1) {
-					warn("readv");
-					goto err;
-				}
-				name[nlen] = 0;
-			}
-
-			if ((src = mmap(NULL, w * h * sizeof(xrgb), PROT_READ, MAP_PRIVATE,
-			                mfd, 0))
-			    == MAP_FAILED)
-			{
-				warn("mmap");
-				goto err;
-			}
-
-			da_foreach (&outputs, out) {
-				if (!name || streq(out->human_name, name)) {
-					if (w * h == 0)
-						clear(out);
-					else {
-						out->iw = w;
-						out->ih = h;
-						if (!mkbuf(out, src, w, h))
-							goto err;
-						draw(out);
-					}
-				}
+			else {
+				/* Clients may send any number of messages before hanging up;
+				   flush after each so that they take effect right away */
+				while (sock_msg(cfd))
+					wl_display_flush(disp);
+				close(cfd);
 			}
+		} else if (EVENT(ZJOB, POLLIN))
+			preload_zdone();
 
-err:
-			free(name);
-			if (mfd != -1)
-				close(mfd);
-			if (cfd != -1)
-				close(cfd);
-			if (src != MAP_FAILED)
-				munmap(src, w * h * sizeof(xrgb));
-		}
+		if (settle_at && pace_now() >= settle_at)
+			out_settle();
 #undef EVENT
 	}
 
@@ -313,183 +750,2101 @@ err:
 #undef FD
 }
 
-void
-surf_create(struct output *out)
+/* Read and handle a single message from a client, returning false once the
+   client hangs up or sends something we can’t make sense of */
+bool
+sock_msg(int cfd)
 {
-	u32 anchor;
-	wl_region_t *input, *opaque;
-
-	if (!comp || !lshell)
-		return;
-
-	out->surf = wl_compositor_create_surface(comp);
-
-	input = wl_compositor_create_region(comp);
-	opaque = wl_compositor_create_region(comp);
-	wl_surface_set_input_region(out->surf, input);
-	wl_surface_set_opaque_region(out->surf, opaque);
-	wl_region_destroy(input);
-	wl_region_destroy(opaque);
+	int mfd = -1;
+	bool rv = false;
+	u32 type;
+	ssize_t n;
+	u8 fdbuf[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = {.iov_base = &type, .iov_len = sizeof(type)};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = fdbuf,
+		.msg_controllen = sizeof(fdbuf),
+	};
+	struct cmsghdr *cmsg;
 
-	out->layer = zwlr_layer_shell_v1_get_layer_surface(
-		lshell, out->surf, out->wl_out, ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND,
-		"wallpaper");
+	if ((n = recvmsg(cfd, &msg, MSG_WAITALL)) == -1) {
+		warn("recvmsg");
+		return false;
+	}
 
-	anchor = ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP
-	       | ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT
-	       | ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM
-	       | ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT;
-	zwlr_layer_surface_v1_set_exclusive_zone(out->layer, -1);
-	zwlr_layer_surface_v1_set_anchor(out->layer, anchor);
-	zwlr_layer_surface_v1_add_listener(out->layer, &ls_listener, out);
+	/* Any file descriptor is sent along with the first byte of the message,
+	   so we need to grab it now even though we don’t yet know if this type of
+	   message even wants one */
+	if ((cmsg = CMSG_FIRSTHDR(&msg)) && cmsg->cmsg_type == SCM_RIGHTS)
+		memcpy(&mfd, CMSG_DATA(cmsg), sizeof(mfd));
 
-	wl_surface_commit(out->surf);
-}
+	if (n == 0)
+		;
+	else if (n != sizeof(type))
+		warnx("Received truncated message");
+	else {
+		switch (type) {
+		case EWD_MSG_SET:
+			rv = msg_set(cfd, mfd);
+			break;
+		case EWD_MSG_STATS:
+			rv = msg_stats(cfd);
+			break;
+		case EWD_MSG_VIEW:
+			rv = msg_view(cfd);
+			break;
+		case EWD_MSG_OUTPUTS:
+			rv = msg_outputs(cfd);
+			break;
+		case EWD_MSG_PRELOAD:
+			rv = msg_preload(cfd, mfd);
+			break;
+		case EWD_MSG_SHOW:
+			rv = msg_show(cfd);
+			break;
+		case EWD_MSG_UNLOAD:
+			rv = msg_unload(cfd);
+			break;
+		case EWD_MSG_UPDATE:
+			rv = msg_update(cfd, mfd);
+			break;
+		case EWD_MSG_LAYER:
+			rv = msg_layer(cfd, mfd);
+			break;
+		default:
+			warnx("Received message of unknown type %" PRIu32, type);
+		}
+	}
 
-void
-clear(struct output *out)
-{
-	out_layer_free(out);
-	surf_create(out);
+	if (mfd != -1)
+		close(mfd);
+	return rv;
 }
 
 bool
-mkbuf(struct output *out, u8 *src, u32 w, u32 h)
+msg_set(int cfd, int mfd)
 {
-	int mfd = -1;
 	bool rv = false;
-	wl_shm_pool_t *pool;
+	char *name;
+	size_t size = 0;
+	u64 hash = 0;
+	u8 *src = MAP_FAILED;
+	u32 *durs = NULL;
+	struct anim *anim = NULL;
+	struct sbuf *b;
+	struct layout lay;
+	struct {
+		struct sjob *buf;
+		size_t len, cap;
+	} jobs = {0};
+	struct {
+		u32 w, h, nframes, flags, mode;
+		xrgb bg;
+	} hdr;
 
-	out->buf.size = out->dw * out->dh * sizeof(xrgb);
+	if (!readall(cfd, &hdr, sizeof(hdr)) || !recv_name(cfd, &name))
+		return false;
 
-	if ((mfd = memfd_create("ewd-shm", 0)) == -1) {
-		warn("memfd_create");
-		goto err;
+	if (hdr.nframes) {
+		durs = xcalloc(hdr.nframes, sizeof(*durs));
+		if (!readall(cfd, durs, hdr.nframes * sizeof(*durs)))
+			goto err;
 	}
-	if (ftruncate(mfd, out->buf.size) == -1) {
-		warn("ftruncate");
-		goto err;
+
+	/* The message has been read in full; anything that goes wrong from here
+	   on doesn’t stop us from reading the next one */
+	rv = true;
+
+	lay = (struct layout){
+		.mode = hdr.mode,
+		.bg = hdr.bg,
+		.span = hdr.flags & EWD_SET_SPAN,
+	};
+	if (lay.mode > EWD_PLACE_TILE) {
+		warnx("Received invalid placement mode %" PRIu32, lay.mode);
+		lay.mode = EWD_PLACE_FILL;
 	}
-	if ((out->buf.p = mmap(NULL, out->buf.size, PROT_READ | PROT_WRITE,
-	                       MAP_SHARED, mfd, 0))
-	    == MAP_FAILED)
-	{
-		warn("mmap");
-		goto err;
+	if (lay.span && (name || hdr.nframes > 1)) {
+		warnx("Only still images set on all displays can span them");
+		lay.span = false;
 	}
 
-	if (!(pool = wl_shm_create_pool(shm, mfd, out->buf.size))) {
-		warnx("Failed to create shm pool");
+	if (!img_size(hdr.w, hdr.h, hdr.nframes, &size))
+		goto err;
+	if (size && mfd == -1) {
+		warnx("Received image without a file descriptor");
 		goto err;
 	}
-	if (!(out->wl_buf = wl_shm_pool_create_buffer(pool, 0, out->dw, out->dh,
-	                                              out->dw * sizeof(xrgb),
-	                                              WL_SHM_FORMAT_XRGB8888)))
-	{
-		warnx("Failed to create shm pool buffer");
+	if (size && (src = map_image(mfd, size)) == MAP_FAILED)
 		goto err;
+
+	/* The animation takes ownership of the source mapping and the frame
+	   durations */
+	if (hdr.nframes > 1) {
+		if (!size) {
+			warnx("Received animation without any pixels");
+			goto err;
+		}
+		anim = anim_new(src, size, hdr.w, hdr.h, hdr.nframes, durs);
+		src = MAP_FAILED;
+		durs = NULL;
+	} else if (size)
+		hash = bcache_hash(src, size);
+
+	/* Scale a still image for every output up front, all in parallel and
+	   only once per distinct size, so that out_show() finds it in the buffer
+	   cache */
+	if (size && !anim) {
+		da_init(&jobs, MAX(outputs.len, 1));
+		da_foreach (&outputs, op) {
+			struct output *out = *op;
+			if ((!name || (out->human_name && streq(out->human_name, name)))
+			    && !out_asleep(out)
+			    && (b = out_prescale(out, &lay, hash, hdr.w, hdr.h)))
+			{
+				da_append(&jobs, ((struct sjob){.b = b, .src = src}));
+			}
+		}
+		bcache_scale(jobs.buf, jobs.len);
+	}
+
+	target_set(name, anim || !size ? -1 : mfd, hdr.w, hdr.h, hash, &lay,
+	           anim);
+	da_foreach (&outputs, op) {
+		struct output *out = *op;
+		if (!name || (out->human_name && streq(out->human_name, name))) {
+			anim_stop(out);
+			out_unset(out);
+			if (size == 0)
+				clear(out);
+			else if (anim)
+				anim_start(out, anim);
+			else if (!out_show(out, mfd, src, hdr.w, hdr.h, hash, &lay))
+				goto err;
+		}
 	}
-	wl_shm_pool_destroy(pool);
 
-	scale(out->buf.p, out->dw, out->dh, src, w, h);
-	rv = true;
 err:
-	close(mfd);
+	da_foreach (&jobs, j)
+		bcache_put(j->b);
+	free(jobs.buf);
+	free(name);
+	free(durs);
+	if (anim)
+		anim_unref(anim);
+	if (src != MAP_FAILED)
+		munmap(src, size);
 	return rv;
 }
 
-void
-draw(struct output *out)
+/* Register an image to be shown later and scale it to the size of every
+   output right away.  We reply with the handle of the image, or 0 if it
+   couldn’t be preloaded. */
+bool
+msg_preload(int cfd, int mfd)
 {
-	wl_buffer_add_listener(out->wl_buf, &buf_listener, out);
-	wl_surface_attach(out->surf, out->wl_buf, 0, 0);
-	wl_surface_damage_buffer(out->surf, 0, 0, out->dw, out->dh);
-	wl_surface_commit(out->surf);
-}
+	u32 id = 0, w, h;
+	size_t size, need;
+	struct preload *p;
+	struct pbuf *pb;
+	struct sbuf *b;
+	struct {
+		u32 w, h;
+	} hdr;
 
-void
-reg_add(void *data, wl_registry_t *reg, u32 name, const char *iface, u32 ver)
-{
-#define assert_ver(n) \
-	if (ver < n) { \
-		diex("The v%" PRIu32 " %s interface is required, but the compositor " \
-		     "only supports v%" PRIu32, \
-		     n, iface, ver); \
+	if (!readall(cfd, &hdr, sizeof(hdr)))
+		return false;
+
+	if (!img_size(hdr.w, hdr.h, 1, &size))
+		goto out;
+	if (size == 0 || mfd == -1) {
+		warnx("Received preload without an image");
+		goto out;
 	}
-#define is(s) streq(iface, s.name)
 
-	if (is(wl_compositor_interface)) {
-		assert_ver(4);
-		comp = wl_registry_bind(reg, name, &wl_compositor_interface, 4);
-	} else if (is(wl_shm_interface)) {
-		shm = wl_registry_bind(reg, name, &wl_shm_interface, 1);
-		wl_shm_add_listener(shm, &shm_listener, NULL);
-	} else if (is(wl_output_interface)) {
-		struct output *out;
-		struct wl_output *wl_out;
+	/* Every output size only needs one buffer */
+	need = size;
+	da_foreach (&outputs, op) {
+		struct output *out = *op;
+		bool seen = false;
+		if (!out->dw || !out->dh)
+			continue;
+		out_bufsize(out, &w, &h);
+		for (struct output **o = outputs.buf; *o != out && !seen; o++) {
+			seen = (*o)->dw == out->dw && (*o)->dh == out->dh
+			    && (*o)->view.scale == out->view.scale
+			    && (*o)->tform == out->tform && (*o)->fmt == out->fmt;
+		}
+		if (!seen)
+			need += (size_t)w * h * fmt_bpp(out->fmt);
+	}
+	if (preload_mem + need > preload_cap) {
+		warnx("Preloading a %" PRIu32 "x%" PRIu32 " image would exceed the "
+		      "memory cap",
+		      hdr.w, hdr.h);
+		goto out;
+	}
 
-		assert_ver(4);
-		wl_out = wl_registry_bind(reg, name, &wl_output_interface, 4);
-		da_append(&outputs, ((struct output){.wl_out = wl_out, .name = name}));
-		out = &outputs.buf[outputs.len - 1];
-		wl_output_add_listener(wl_out, &out_listener, out);
-		surf_create(out);
-	} else if (is(zwlr_layer_shell_v1_interface)) {
-		assert_ver(2);
-		lshell = wl_registry_bind(reg, name, &zwlr_layer_shell_v1_interface, 2);
+	p = xmalloc(sizeof(*p));
+	*p = (struct preload){
+		.w = hdr.w,
+		.h = hdr.h,
+		.mem = size,
+	};
+	if ((p->src = map_image(mfd, size)) == MAP_FAILED) {
+		free(p);
+		goto out;
 	}
-#undef is
-#undef assert_ver
+	if ((p->fd = fcntl(mfd, F_DUPFD_CLOEXEC, 0)) == -1) {
+		warn("fcntl");
+		munmap(p->src, size);
+		free(p);
+		goto out;
+	}
+	p->hash = bcache_hash(p->src, size);
+
+	da_init(&p->bufs, MAX(outputs.len, 1));
+	da_foreach (&outputs, op) {
+		struct output *out = *op;
+		if (!out->dw || !out->dh)
+			continue;
+		out_bufsize(out, &w, &h);
+		if (!(b = bcache_get(shm, p->src, p->hash, p->w, p->h, w, h,
+		                     out->tform, out->fmt, NULL, FILTER_BEST)))
+		{
+			continue;
+		}
+		da_foreach (&p->bufs, q) {
+			if ((*q)->b == b) {
+				bcache_put(b);
+				b = NULL;
+				break;
+			}
+		}
+		if (b) {
+			pb = xcalloc(1, sizeof(*pb));
+			pb->p = p;
+			pb->b = b;
+			pb->tform = out->tform;
+			pb->fmt = out->fmt;
+			da_append(&p->bufs, pb);
+			p->mem += b->size;
+		}
+	}
+
+	/* Nothing shows a freshly preloaded image yet, so compress it straight
+	   away.  Only XRGB8888 buffers can be compressed; those in compact
+	   formats stay as they are. */
+	da_foreach (&p->bufs, q) {
+		pb = *q;
+		if (pb->fmt != WL_SHM_FORMAT_XRGB8888)
+			continue;
+		pb->job = xmalloc(sizeof(*pb->job));
+		*pb->job = (struct zjob){
+			.src = (xrgb *)pb->b->p,
+			.w = pb->b->w,
+			.h = pb->b->h,
+			.data = pb,
+		};
+		zjob_push(pb->job);
+	}
+
+	id = p->id = preload_next++;
+	preload_mem += p->mem;
+	da_append(&preloads, p);
+
+out:
+	if (write(cfd, &id, sizeof(id)) == -1)
+		warn("write");
+	return true;
 }
 
-void
-reg_del(void *data, wl_registry_t *reg, u32 name)
+/* Show a preloaded image on the requested outputs.  Its buffers are already
+   scaled, so this is no more than attaching one to the surface and at worst
+   decompressing it first. */
+bool
+msg_show(int cfd)
 {
-	da_foreach (&outputs, out) {
-		if (out->name == name) {
-			out_layer_free(out);
-			if (out->wl_out)
-				wl_output_release(out->wl_out);
-			free(out->human_name);
-			da_remove(&outputs, out - outputs.buf);
-			return;
+	u32 id;
+	char *name;
+	struct preload *p;
+	struct sbuf *b;
+	struct layout lay = {.mode = EWD_PLACE_FILL};
+
+	if (!readall(cfd, &id, sizeof(id)) || !recv_name(cfd, &name))
+		return false;
+
+	if (!(p = preload_find(id))) {
+		warnx("Received unknown preload handle %" PRIu32, id);
+		goto err;
+	}
+
+	target_set(name, p->fd, p->w, p->h, p->hash, &lay, NULL);
+	da_foreach (&outputs, op) {
+		struct output *out = *op;
+		if (!name || (out->human_name && streq(out->human_name, name))) {
+			anim_stop(out);
+			out_unset(out);
+
+			/* Make sure the buffer is in the cache for out_show() to find */
+			b = out_asleep(out) ? NULL : preload_buf(p, out);
+			out_show(out, p->fd, p->src, p->w, p->h, p->hash, &lay);
+			if (b)
+				bcache_put(b);
 		}
 	}
-}
 
-void
-out_mode(void *data, wl_output_t *out, u32 flags, i32 w, i32 h, i32 fps)
-{
-	((struct output *)data)->dw = w;
-	((struct output *)data)->dh = h;
+err:
+	free(name);
+	return true;
 }
 
-void
-out_name(void *data, wl_output_t *wl_out, const char *name)
+/* Forget a preloaded image.  Outputs still showing it keep doing so. */
+bool
+msg_unload(int cfd)
 {
-	if (!(((struct output *)data)->human_name = strdup(name)))
-		warn("strdup: %s", name);
-}
+	u32 id;
 
-void
-out_scale(void *data, wl_output_t *wl_out, i32 scale)
-{
-}
+	if (!readall(cfd, &id, sizeof(id)))
+		return false;
 
-void
-out_geom(void *data, wl_output_t *out, i32 x, i32 y, i32 pw, i32 ph, i32 sp,
-         const char *make, const char *model, i32 tform)
-{
+	for (size_t i = 0; i < preloads.len; i++) {
+		if (preloads.buf[i]->id == id) {
+			preload_free(preloads.buf[i]);
+			da_remove(&preloads, i);
+			return true;
+		}
+	}
+
+	warnx("Received unknown preload handle %" PRIu32, id);
+	return true;
 }
 
-void
+/* Draw a patch over part of the still image shown on the requested outputs.
+   Only the patch is copied and only it is damaged, so the cost of an update
+   scales with the size of the patch rather than that of the output. */
+bool
+msg_update(int cfd, int mfd)
+{
+	char *name;
+	size_t size;
+	u8 *src;
+	struct {
+		u32 x, y, w, h; /* On-screen pixels */
+	} hdr;
+
+	if (!readall(cfd, &hdr, sizeof(hdr)) || !recv_name(cfd, &name))
+		return false;
+
+	if (!img_size(hdr.w, hdr.h, 1, &size))
+		goto err;
+	if (size == 0 || mfd == -1) {
+		warnx("Received update without a patch");
+		goto err;
+	}
+	if ((src = map_image(mfd, size)) == MAP_FAILED)
+		goto err;
+
+	da_foreach (&outputs, op) {
+		struct output *out = *op;
+		if (!name || (out->human_name && streq(out->human_name, name))) {
+			out_update(out, src, hdr.w,
+			           (struct rect){hdr.x, hdr.y, hdr.w, hdr.h});
+		}
+	}
+	munmap(src, size);
+
+err:
+	free(name);
+	return true;
+}
+
+/* Set, change or remove a layer drawn over the still images of the
+   requested outputs */
+bool
+msg_layer(int cfd, int mfd)
+{
+	char *name;
+	u8 *map;
+	size_t size = 0;
+	struct overlay ov;
+	struct {
+		u32 id;
+		u32 x, y, w, h; /* On-screen pixels */
+		u32 color;      /* Premultiplied ARGB */
+	} hdr;
+
+	if (!readall(cfd, &hdr, sizeof(hdr)) || !recv_name(cfd, &name))
+		return false;
+
+	ov = (struct overlay){
+		.r = {hdr.x, hdr.y, hdr.w, hdr.h},
+		.stride = hdr.w,
+		.color = hdr.color,
+	};
+	if (mfd != -1 && !img_size(hdr.w, hdr.h, 1, &size))
+		goto err;
+
+	da_foreach (&outputs, op) {
+		struct output *out = *op;
+		if (name && (!out->human_name || !streq(out->human_name, name)))
+			continue;
+
+		/* Every output gets its own mapping of the image to hold onto */
+		map = NULL;
+		if (size && (map = map_image(mfd, size)) == MAP_FAILED)
+			break;
+		ov.src = map;
+		lyr_set(out, hdr.id, ov, map, size);
+	}
+
+err:
+	free(name);
+	return true;
+}
+
+/* Reply with the frame pacing statistics of the requested outputs */
+bool
+msg_stats(int cfd)
+{
+	char *name;
+
+	if (!recv_name(cfd, &name))
+		return false;
+
+	da_foreach (&outputs, op) {
+		struct output *out = *op;
+		const char *s = out->human_name ? out->human_name : "?";
+
+		if (name && (!out->human_name || !streq(out->human_name, name)))
+			continue;
+
+		dprintf(cfd,
+		        "%s frames presented=%" PRIu64 " discarded=%" PRIu64
+		        " dropped=%" PRIu64 " refresh=%" PRIu32 "\n",
+		        s, out->pace.presented, out->pace.discarded, out->pace.dropped,
+		        out->pace.refresh);
+		hist_print(cfd, s, "interval", &out->pace.interval);
+		hist_print(cfd, s, "missed", &out->pace.missed);
+		hist_print(cfd, s, "latency", &out->pace.latency);
+		dprintf(cfd,
+		        "%s governor tier=%d avg=%" PRIu64 " budget=%" PRIu64
+		        " changes=%" PRIu64 "\n",
+		        s, out->gov.tier, out->gov.avg / 1000, out->gov.budget / 1000,
+		        out->gov.changes);
+		dprintf(cfd,
+		        "%s sleep state=%s skipped=%" PRIu64 " deferred=%" PRIu64 "\n",
+		        s, out->sleep.off ? "off" : idle ? "idle" : "on",
+		        out->sleep.skipped, out->sleep.deferred);
+	}
+	bcache_print(cfd);
+	dprintf(cfd, "preloads count=%zu size=%zu cap=%zu\n", preloads.len,
+	        preload_mem, preload_cap);
+
+	free(name);
+	return true;
+}
+
+/* Pan and zoom the images of the requested outputs */
+bool
+msg_view(int cfd)
+{
+	char *name;
+	struct view v;
+	struct {
+		u32 x, y; /* Permille */
+		u32 zoom; /* Percent */
+		u32 dur;  /* Milliseconds */
+		u32 flags;
+	} hdr;
+
+	if (!readall(cfd, &hdr, sizeof(hdr)) || !recv_name(cfd, &name))
+		return false;
+
+	if (hdr.x > 1000 || hdr.y > 1000 || hdr.zoom < 100
+	    || hdr.zoom > VIEW_ZOOM_MAX)
+	{
+		warnx("Received invalid view");
+		goto err;
+	}
+	if (!vper) {
+		warnx("Compositor lacks wp_viewporter support; ignoring view");
+		goto err;
+	}
+
+	v.x = hdr.x / 1000.;
+	v.y = hdr.y / 1000.;
+	v.z = hdr.zoom / 100.;
+
+	da_foreach (&outputs, op) {
+		struct output *out = *op;
+		if (!name || (out->human_name && streq(out->human_name, name)))
+			view_set(out, v, MS(hdr.dur), hdr.flags & EWD_VIEW_BOUNCE);
+	}
+
+err:
+	free(name);
+	return true;
+}
+
+/* Reply with the dimensions of the requested outputs, so that clients can
+   decode images at no more than the size they’ll be shown at */
+bool
+msg_outputs(int cfd)
+{
+	char *name;
+
+	if (!recv_name(cfd, &name))
+		return false;
+
+	da_foreach (&outputs, op) {
+		struct output *out = *op;
+		if (!name || (out->human_name && streq(out->human_name, name))) {
+			dprintf(cfd, "%s %" PRIu32 " %" PRIu32 "\n",
+			        out->human_name ? out->human_name : "?", out->dw,
+			        out->dh);
+		}
+	}
+
+	free(name);
+	return true;
+}
+
+/* Read a length-prefixed display name.  The empty name refers to all displays
+   and is returned as NULL. */
+bool
+recv_name(int cfd, char **name)
+{
+	size_t n;
+
+	*name = NULL;
+	if (!readall(cfd, &n, sizeof(n)))
+		return false;
+	if (n == 0)
+		return true;
+
+	*name = xmalloc(n + 1);
+	if (!readall(cfd, *name, n)) {
+		free(*name);
+		*name = NULL;
+		return false;
+	}
+	(*name)[n] = 0;
+	return true;
+}
+
+bool
+readall(int fd, void *buf, size_t n)
+{
+	while (n > 0) {
+		ssize_t nr = read(fd, buf, n);
+		if (nr == -1) {
+			if (errno == EINTR)
+				continue;
+			warn("read");
+			return false;
+		}
+		if (nr == 0) {
+			warnx("Received truncated message");
+			return false;
+		}
+		buf = (u8 *)buf + nr;
+		n -= nr;
+	}
+	return true;
+}
+
+/* Get the size of ‘n’ frames of a ‘w’×‘h’ image, returning false if it
+   doesn’t even fit in a size_t */
+bool
+img_size(u32 w, u32 h, u32 n, size_t *size)
+{
+	if (n && (size_t)w * h > SIZE_MAX / sizeof(xrgb) / n) {
+		warnx("Received image of impossible size");
+		return false;
+	}
+	*size = (size_t)w * h * sizeof(xrgb) * n;
+	return true;
+}
+
+/* Map the first ‘size’ bytes of an image sent to us in the memfd ‘fd’.  The
+   size comes from the client, who may also shrink the file at any time after
+   sending it, and reading past the end of a shorter file would kill us with
+   SIGBUS, so we check it on every mapping. */
+u8 *
+map_image(int fd, size_t size)
+{
+	u8 *p;
+	struct stat sb;
+
+	if (fstat(fd, &sb) == -1) {
+		warn("fstat");
+		return MAP_FAILED;
+	}
+	if (sb.st_size < 0 || (u64)sb.st_size < size) {
+		warnx("Received image larger than its file");
+		return MAP_FAILED;
+	}
+	if ((p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+		warn("mmap");
+	return p;
+}
+
+void
+surf_create(struct output *out)
+{
+	u32 anchor;
+	wl_region_t *input, *opaque;
+
+	if (!comp || !lshell)
+		return;
+
+	out->surf = wl_compositor_create_surface(comp);
+
+	input = wl_compositor_create_region(comp);
+	opaque = wl_compositor_create_region(comp);
+	wl_surface_set_input_region(out->surf, input);
+	wl_surface_set_opaque_region(out->surf, opaque);
+	wl_region_destroy(input);
+	wl_region_destroy(opaque);
+
+	if (vper)
+		out->vp = wp_viewporter_get_viewport(vper, out->surf);
+	if (fsmgr) {
+		out->fs = wp_fractional_scale_manager_v1_get_fractional_scale(
+			fsmgr, out->surf);
+		wp_fractional_scale_v1_add_listener(out->fs, &fs_listener, out);
+	}
+
+	out->layer = zwlr_layer_shell_v1_get_layer_surface(
+		lshell, out->surf, out->wl_out, ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND,
+		"wallpaper");
+
+	anchor = ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP
+	       | ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT
+	       | ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM
+	       | ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT;
+	zwlr_layer_surface_v1_set_exclusive_zone(out->layer, -1);
+	zwlr_layer_surface_v1_set_anchor(out->layer, anchor);
+	zwlr_layer_surface_v1_add_listener(out->layer, &ls_listener, out);
+
+	wl_surface_commit(out->surf);
+}
+
+void
+clear(struct output *out)
+{
+	out_layer_free(out);
+	lyr_free(out);
+	surf_create(out);
+}
+
+/* Get the current image scaled to the size of the output, which may well
+   already be lying around from an earlier time it was shown */
+bool
+mkbuf(struct output *out, u8 *src)
+{
+	u32 w, h;
+	struct sbuf *b;
+	struct place pl;
+	const struct place *p;
+
+	out_bufsize(out, &w, &h);
+	p = out_place(out, &out->lay, out->iw, out->ih, &pl);
+	if (!(b = bcache_get(shm, src, out->ihash, out->iw, out->ih, w, h,
+	                     out->tform, out->fmt, p, FILTER_BEST)))
+	{
+		return false;
+	}
+	if (out->lyr.base)
+		lyr_stop(out);
+	upd_free(out);
+	if (out->buf)
+		bcache_put(out->buf);
+	out->buf = b;
+	if (lyr_shown(out))
+		lyr_start(out);
+	return true;
+}
+
+/* Get the size of the buffer to scale still images to, allowing for the
+   output to be zoomed in */
+void
+out_bufsize(struct output *out, u32 *w, u32 *h)
+{
+	*w = MAX((u64)out->dw * out->view.scale / 100, 1);
+	*h = MAX((u64)out->dh * out->view.scale / 100, 1);
+	out_orient(out, w, h);
+}
+
+/* Swap ‘w’ and ‘h’ if the output is rotated by a quarter turn, converting
+   between on-screen dimensions and buffer dimensions */
+void
+out_orient(struct output *out, u32 *w, u32 *h)
+{
+	if (TFORM_SWAPS(out->tform)) {
+		u32 t = *w;
+		*w = *h;
+		*h = t;
+	}
+}
+
+/* Work out where an image goes on an output, or return NULL if it simply
+   fills the output, which scale() does by itself.  An image spanning all
+   outputs is placed on a canvas made up of all of them, laid out as the
+   compositor lays them out and with gaps for the bezels between them, of
+   which each output shows only its own part.  Images shown centered or tiled
+   keep their size in the units of the layout. */
+const struct place *
+out_place(struct output *out, const struct layout *lay, u32 sw, u32 sh,
+          struct place *pl)
+{
+	double k, ix, iy, iw, ih;
+	i32 x0 = INT32_MAX, y0 = INT32_MAX;
+	u64 ox = 0, oy = 0, ow = out->lw, oh = out->lh, cw, ch;
+
+	/* Without a surface size we go by pixels */
+	if (!ow || !oh) {
+		ow = out->dw;
+		oh = out->dh;
+	}
+	cw = ow;
+	ch = oh;
+
+	if (lay->span && out->lw && out->lh) {
+		da_foreach (&outputs, oq) {
+			struct output *o = *oq;
+			if (o->lw) {
+				x0 = MIN(x0, o->x);
+				y0 = MIN(y0, o->y);
+			}
+		}
+		cw = ch = 0;
+		da_foreach (&outputs, oq) {
+			struct output *o = *oq;
+			if (o->lw) {
+				cw = MAX(cw, span_off(o->x, x0, false) + o->lw);
+				ch = MAX(ch, span_off(o->y, y0, true) + o->lh);
+			}
+		}
+		ox = span_off(out->x, x0, false);
+		oy = span_off(out->y, y0, true);
+	} else if (lay->mode == EWD_PLACE_FILL)
+		return NULL;
+
+	switch (lay->mode) {
+	case EWD_PLACE_FILL:
+	case EWD_PLACE_FIT:
+		k = lay->mode == EWD_PLACE_FILL
+		      ? MAX((double)cw / sw, (double)ch / sh)
+		      : MIN((double)cw / sw, (double)ch / sh);
+		iw = sw * k;
+		ih = sh * k;
+		break;
+	case EWD_PLACE_STRETCH:
+		iw = cw;
+		ih = ch;
+		break;
+	default:
+		iw = sw;
+		ih = sh;
+	}
+
+	/* Tiles start at the corner of the canvas, everything else is centered
+	   on it */
+	ix = lay->mode == EWD_PLACE_TILE ? 0 : (cw - iw) / 2;
+	iy = lay->mode == EWD_PLACE_TILE ? 0 : (ch - ih) / 2;
+	*pl = (struct place){
+		.x = (ix - ox) / ow,
+		.y = (iy - oy) / oh,
+		.w = iw / ow,
+		.h = ih / oh,
+		.tile = lay->mode == EWD_PLACE_TILE,
+		.bg = lay->bg,
+	};
+	return pl;
+}
+
+/* Get the offset of an output at ‘v’ from the edge ‘v0’ of the canvas of a
+   spanned image, horizontally or vertically.  Every distinct edge of another
+   output before it is another column (or row) of outputs whose bezel adds to
+   the offset. */
+u64
+span_off(i32 v, i32 v0, bool vert)
+{
+	u64 n = 0;
+
+	for (size_t i = 0; i < outputs.len; i++) {
+		struct output *o = outputs.buf[i];
+		i32 e = vert ? o->y : o->x;
+		bool seen = !o->lw || e >= v;
+
+		for (size_t j = 0; j < i && !seen; j++) {
+			o = outputs.buf[j];
+			seen = o->lw && (vert ? o->y : o->x) == e;
+		}
+		n += !seen;
+	}
+	return (u64)((i64)v - v0) + n * (vert ? bezel_y : bezel_x);
+}
+
+/* Get a buffer for an output to scale a still image into with
+   bcache_scale(), or NULL if the buffer cache already has the image at the
+   size of the output */
+struct sbuf *
+out_prescale(struct output *out, const struct layout *lay, u64 hash, u32 sw,
+             u32 sh)
+{
+	u32 w, h;
+	struct sbuf *b;
+	struct place pl;
+	const struct place *p;
+
+	if (!out->dw || !out->dh)
+		return NULL;
+	out_bufsize(out, &w, &h);
+	p = out_place(out, lay, sw, sh, &pl);
+	if ((b = bcache_find(hash, sw, sh, w, h, out->tform, out->fmt, p,
+	                     FILTER_BEST)))
+	{
+		bcache_put(b);
+		return NULL;
+	}
+	return bcache_new(shm, hash, sw, sh, w, h, out->tform, out->fmt, p,
+	                  FILTER_BEST);
+}
+
+/* Show a still image on an output.  We hold onto the image so that we can
+   scale it again later, for example once the output wakes up. */
+bool
+out_show(struct output *out, int fd, u8 *src, u32 w, u32 h, u64 hash,
+         const struct layout *lay)
+{
+	if ((out->ifd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) == -1) {
+		warn("fcntl");
+		return false;
+	}
+	out->iw = w;
+	out->ih = h;
+	out->ihash = hash;
+	out->lay = *lay;
+	if (out_asleep(out)) {
+		out->sleep.pending = true;
+		out->sleep.deferred++;
+	} else if (!mkbuf(out, src))
+		return false;
+	else
+		draw(out);
+	return true;
+}
+
+/* Draw the patch ‘src’, whose rows are ‘stride’ pixels apart, over the
+   on-screen rectangle ‘r’ of the still image shown on an output.  With
+   layers on top, the patch goes into the image beneath them and only the
+   patched area is composed again. */
+void
+out_update(struct output *out, const u8 *src, u32 stride, struct rect r)
+{
+	struct sbuf *b;
+
+	if (!out->buf || out->anim.ring || out_asleep(out)) {
+		warnx("No still image on screen to update");
+		return;
+	}
+	if (out->view.scale != 100) {
+		warnx("Can’t update the image of a zoomed in output");
+		return;
+	}
+	if (!out_clip(out, &r)) {
+		warnx("Update lies outside the output");
+		return;
+	}
+
+	if ((b = out->lyr.base)) {
+		if (!out->lyr.own) {
+			if (!(b = bcache_new(shm, 0, 0, 0, b->w, b->h, b->tform, b->fmt,
+			                     NULL, FILTER_BEST)))
+			{
+				return;
+			}
+			bcache_copy(b, out->lyr.base, 0, 0, b->w, b->h);
+			bcache_put(out->lyr.base);
+			out->lyr.base = b;
+			out->lyr.own = true;
+		}
+		patch(b->p, b->w, b->h, b->fmt, b->tform, src, stride, r);
+		lyr_compose(out, &r, 1);
+		return;
+	}
+
+	if (!out_flip(out))
+		return;
+	b = out->buf;
+	r = patch(b->p, b->w, b->h, b->fmt, b->tform, src, stride, r);
+	out_stale(out, r);
+	b->busy = true;
+	wl_surface_attach(out->surf, b->wl_buf, 0, 0);
+	wl_surface_damage_buffer(out->surf, r.x, r.y, r.w, r.h);
+	wl_surface_commit(out->surf);
+}
+
+/* Clip the on-screen rectangle ‘r’ to an output, returning false if nothing
+   of it is left */
+bool
+out_clip(struct output *out, struct rect *r)
+{
+	if (r->x >= out->dw || r->y >= out->dh || !r->w || !r->h)
+		return false;
+	r->w = MIN(r->w, out->dw - r->x);
+	r->h = MIN(r->h, out->dh - r->y);
+	return true;
+}
+
+/* Make sure that the current buffer of an output is our own and not held by
+   the compositor, so that we can draw into it */
+bool
+out_flip(struct output *out)
+{
+	struct sbuf *b, *front = out->buf;
+
+	if (out->upd.own && !front->busy)
+		return true;
+
+	b = out->upd.back;
+	if (out->upd.own && b && !b->busy) {
+		da_foreach (&out->upd.stale, p)
+			bcache_copy(b, front, p->x, p->y, p->w, p->h);
+	} else {
+		if (!(b = bcache_new(shm, 0, 0, 0, front->w, front->h, front->tform,
+		                     front->fmt, NULL, FILTER_BEST)))
+		{
+			return false;
+		}
+		bcache_copy(b, front, 0, 0, front->w, front->h);
+		if (!out->upd.own)
+			bcache_put(front);
+		else if (out->upd.back)
+			bcache_put(out->upd.back);
+	}
+	out->upd.back = out->upd.own ? front : NULL;
+	out->upd.own = true;
+	out->upd.stale.len = 0;
+	out->buf = b;
+	return true;
+}
+
+/* Remember that the rectangle ‘r’ of the current buffer of an output was
+   drawn to, so that the other buffer can be brought up to date later */
+void
+out_stale(struct output *out, struct rect r)
+{
+	u32 x1, y1;
+
+	if (!out->upd.back)
+		return;
+
+	/* Too many rectangles cost more to copy one by one than the area
+	   around them all */
+	if (out->upd.stale.len == UPD_STALE_MAX) {
+		x1 = r.x + r.w;
+		y1 = r.y + r.h;
+		da_foreach (&out->upd.stale, p) {
+			r.x = MIN(r.x, p->x);
+			r.y = MIN(r.y, p->y);
+			x1 = MAX(x1, p->x + p->w);
+			y1 = MAX(y1, p->y + p->h);
+		}
+		r.w = x1 - r.x;
+		r.h = y1 - r.y;
+		out->upd.stale.len = 0;
+	}
+	da_append(&out->upd.stale, r);
+}
+
+/* Are the layers of an output drawn over its image?  They aren’t drawn over
+   animations, nor over zoomed in images which no longer line up with the
+   pixels of the output. */
+bool
+lyr_shown(struct output *out)
+{
+	return out->lyr.layers.len && out->view.scale == 100 && !out->anim.ring;
+}
+
+/* Compose the image of an output with its layers into a new buffer of our
+   own, which becomes the current buffer.  The image itself becomes the base
+   of the layers. */
+bool
+lyr_start(struct output *out)
+{
+	struct sbuf *b, *base = out->buf;
+
+	if (!(b = bcache_new(shm, 0, 0, 0, base->w, base->h, base->tform,
+	                     base->fmt, NULL, FILTER_BEST)))
+	{
+		return false;
+	}
+	upd_free(out);
+	out->lyr.base = base;
+	out->lyr.own = false;
+	out->buf = b;
+	out->upd.own = true;
+	lyr_compose_into(out, b, (struct rect){0, 0, out->dw, out->dh});
+	return true;
+}
+
+/* Compose the on-screen rectangles ‘rs’ of an output again and show them */
+void
+lyr_compose(struct output *out, const struct rect *rs, size_t n)
+{
+	struct rect r;
+	struct sbuf *b;
+
+	if (!out_flip(out))
+		return;
+	b = out->buf;
+	for (size_t i = 0; i < n; i++) {
+		r = lyr_compose_into(out, b, rs[i]);
+		out_stale(out, r);
+		wl_surface_damage_buffer(out->surf, r.x, r.y, r.w, r.h);
+	}
+	b->busy = true;
+	wl_surface_attach(out->surf, b->wl_buf, 0, 0);
+	wl_surface_commit(out->surf);
+}
+
+/* Compose the on-screen rectangle ‘r’ of an output into the buffer ‘b’,
+   returning the rectangle of the buffer that was drawn to */
+struct rect
+lyr_compose_into(struct output *out, struct sbuf *b, struct rect r)
+{
+	struct rect br;
+	struct overlay *ov;
+	size_t n = out->lyr.layers.len;
+
+	ov = xcalloc(MAX(n, 1), sizeof(*ov));
+	for (size_t i = 0; i < n; i++)
+		ov[i] = out->lyr.layers.buf[i].ov;
+	br = compose(b->p, out->lyr.base->p, b->w, b->h, b->fmt, b->tform, ov, n,
+	             r);
+	free(ov);
+	return br;
+}
+
+/* Set the layer ‘id’ of an output to ‘ov’, whose image (if any) is mapped
+   at ‘map’ of ‘size’ bytes and is ours from now on, or remove the layer if
+   the rectangle of ‘ov’ is empty.  Only the area covered by the layer before
+   and after the change is composed again. */
+void
+lyr_set(struct output *out, u32 id, struct overlay ov, u8 *map, size_t size)
+{
+	size_t i, n = 0;
+	struct rect rs[2];
+	struct layer *l = NULL;
+	bool empty = !ov.r.w || !ov.r.h;
+
+	for (i = 0; i < out->lyr.layers.len; i++) {
+		if (out->lyr.layers.buf[i].id >= id)
+			break;
+	}
+	if (i < out->lyr.layers.len && out->lyr.layers.buf[i].id == id) {
+		l = out->lyr.layers.buf + i;
+		rs[n++] = l->ov.r;
+		if (l->map)
+			munmap(l->map, l->size);
+	}
+	if (!empty)
+		rs[n++] = ov.r;
+
+	if (empty && l)
+		da_remove(&out->lyr.layers, i);
+	else if (!empty && !l) {
+		da_append(&out->lyr.layers, (struct layer){0});
+		l = out->lyr.layers.buf + i;
+		memmove(l + 1, l, (out->lyr.layers.len - i - 1) * sizeof(*l));
+	}
+	if (!empty) {
+		*l = (struct layer){
+			.id = id,
+			.ov = ov,
+			.map = map,
+			.size = size,
+		};
+	}
+
+	/* Layers are kept for later on outputs not showing a still image, and
+	   asleep outputs catch up once they wake up */
+	if (!out->buf || out->anim.ring)
+		return;
+	if (out_asleep(out)) {
+		out->sleep.pending = true;
+		out->sleep.deferred++;
+		return;
+	}
+
+	if (!out->lyr.base) {
+		if (lyr_shown(out) && lyr_start(out))
+			draw(out);
+		return;
+	}
+	if (!out->lyr.layers.len) {
+		lyr_stop(out);
+		draw(out);
+		return;
+	}
+	for (size_t j = 0; j < n;) {
+		if (out_clip(out, rs + j))
+			j++;
+		else
+			rs[j] = rs[--n];
+	}
+	if (n)
+		lyr_compose(out, rs, n);
+}
+
+/* Go back to showing the image of an output without layers */
+void
+lyr_stop(struct output *out)
+{
+	upd_free(out);
+	bcache_put(out->buf);
+	out->buf = out->lyr.base;
+	out->upd.own = out->lyr.own;
+	out->lyr.base = NULL;
+	out->lyr.own = false;
+}
+
+/* Forget the layers of an output */
+void
+lyr_free(struct output *out)
+{
+	da_foreach (&out->lyr.layers, l) {
+		if (l->map)
+			munmap(l->map, l->size);
+	}
+	free(out->lyr.layers.buf);
+	out->lyr.layers.buf = NULL;
+	out->lyr.layers.len = out->lyr.layers.cap = 0;
+}
+
+struct preload *
+preload_find(u32 id)
+{
+	da_foreach (&preloads, p) {
+		if ((*p)->id == id)
+			return *p;
+	}
+	return NULL;
+}
+
+/* Get the buffer of a preloaded image at the size of an output, decompressing
+   it into a recycled buffer if it’s been evicted from the cache.  The caller
+   holds a reference to the returned buffer until it calls bcache_put(). */
+struct sbuf *
+preload_buf(struct preload *p, struct output *out)
+{
+	u32 w, h;
+	struct sbuf *b;
+
+	out_bufsize(out, &w, &h);
+	if ((b = bcache_find(p->hash, p->w, p->h, w, h, out->tform, out->fmt,
+	                     NULL, FILTER_BEST)))
+	{
+		return b;
+	}
+
+	da_foreach (&p->bufs, q) {
+		struct zbuf *z = (*q)->z;
+		if (!z || z->w != w || z->h != h || (*q)->tform != out->tform
+		    || (*q)->fmt != out->fmt)
+		{
+			continue;
+		}
+		if (!(b = bcache_new(shm, p->hash, p->w, p->h, w, h, out->tform,
+		                     out->fmt, NULL, FILTER_BEST)))
+		{
+			return NULL;
+		}
+		if (!zbuf_decompress(z, (xrgb *)b->p)) {
+			warnx("Failed to decompress preloaded image %" PRIu32, p->id);
+			b->hash = 0;
+			bcache_put(b);
+			return NULL;
+		}
+		return b;
+	}
+	return NULL;
+}
+
+/* Swap the scaled buffers of preloaded images for their compressed copies as
+   the background thread gets through them, letting the buffer cache evict
+   them whenever it sees fit */
+void
+preload_zdone(void)
+{
+	struct zjob *j, *next;
+
+	for (j = zjob_done(); j; j = next) {
+		struct pbuf *pb = j->data;
+
+		next = j->next;
+		pb->job = NULL;
+		if (!pb->p) {
+			bcache_put(pb->b);
+			zbuf_free(j->z);
+			free(pb);
+		} else {
+			pb->z = j->z;
+			pb->p->mem = pb->p->mem - pb->b->size + pb->z->size;
+			preload_mem = preload_mem - pb->b->size + pb->z->size;
+			bcache_put(pb->b);
+			pb->b = NULL;
+		}
+		free(j);
+	}
+}
+
+void
+preload_free(struct preload *p)
+{
+	da_foreach (&p->bufs, q) {
+		struct pbuf *pb = *q;
+
+		/* The background thread is still reading the buffer; it’s freed once
+		   the job comes back */
+		if (pb->job) {
+			pb->p = NULL;
+			continue;
+		}
+		if (pb->b)
+			bcache_put(pb->b);
+		zbuf_free(pb->z);
+		free(pb);
+	}
+	free(p->bufs.buf);
+	munmap(p->src, (size_t)p->w * p->h * sizeof(xrgb));
+	close(p->fd);
+	preload_mem -= p->mem;
+	free(p);
+}
+
+/* Remember the image last set on the display ‘name’, or on every display if
+   it’s NULL, in which case it replaces the images of individual displays */
+void
+target_set(const char *name, int fd, u32 w, u32 h, u64 hash,
+           const struct layout *lay, struct anim *a)
+{
+	struct target t = {
+		.fd = -1,
+		.w = w,
+		.h = h,
+		.hash = hash,
+		.lay = *lay,
+		.anim = a ? anim_ref(a) : NULL,
+	};
+
+	if (fd != -1 && (t.fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) == -1)
+		warn("fcntl");
+	if (name && !(t.name = strdup(name)))
+		die("strdup");
+
+	for (size_t i = targets.len; i-- > 0;) {
+		struct target *u = targets.buf + i;
+		if (!name || (u->name && streq(u->name, name))) {
+			target_free(u);
+			da_remove(&targets, i);
+		}
+	}
+	da_append(&targets, t);
+}
+
+/* Get the target of an output.  A target for this output specifically wins
+   over one for all outputs. */
+struct target *
+target_find(struct output *out)
+{
+	struct target *t = NULL;
+
+	da_foreach (&targets, u) {
+		if (!u->name)
+			t = u;
+		else if (out->human_name && streq(u->name, out->human_name))
+			return u;
+	}
+	return t;
+}
+
+void
+target_free(struct target *t)
+{
+	if (t->fd != -1)
+		close(t->fd);
+	if (t->anim)
+		anim_unref(t->anim);
+	free(t->name);
+}
+
+/* Bring an output up to date after it was configured.  An output that isn’t
+   showing anything yet, such as one that was just plugged in, gets the image
+   last set on it; otherwise whatever it’s showing is scaled again if the
+   output changed size.  The buffer cache makes this cheap whenever another
+   output of the same size already shows the image. */
+void
+out_restore(struct output *out, bool resized)
+{
+	u8 *src;
+	size_t size;
+	struct anim *a;
+	struct target *t;
+
+	if (out->anim.ring) {
+		if (resized) {
+			a = anim_ref(out->anim.ring->anim);
+			anim_stop(out);
+			anim_start(out, a);
+			anim_unref(a);
+		}
+		return;
+	}
+	if (out->ifd != -1) {
+		if (resized && out_asleep(out)) {
+			out->sleep.pending = true;
+			out->sleep.deferred++;
+		} else if (resized)
+			rescale(out);
+		return;
+	}
+
+	if (!(t = target_find(out)))
+		return;
+
+	if (t->anim)
+		anim_start(out, t->anim);
+	else if (t->fd != -1) {
+		size = (size_t)t->w * t->h * sizeof(xrgb);
+		if ((src = map_image(t->fd, size)) == MAP_FAILED)
+			return;
+		out_show(out, t->fd, src, t->w, t->h, t->hash, &t->lay);
+		munmap(src, size);
+	}
+}
+
+/* Bring every output whose configuration has settled up to date.  The still
+   images they need are scaled up front, all in parallel and only once per
+   distinct size, so that out_restore() finds them in the buffer cache. */
+void
+out_settle(void)
+{
+	u8 *src;
+	struct target *t;
+	struct sbuf *b;
+	struct {
+		struct sjob *buf;
+		size_t len, cap;
+	} jobs;
+
+	settle_at = 0;
+	da_init(&jobs, MAX(outputs.len, 1));
+
+	/* Images spanning all outputs are cut up by the layout of all of them,
+	   so any output changing moves them about on every other output too */
+	da_foreach (&outputs, op) {
+		struct output *out = *op;
+		if (out->conf.dirty && !out->conf.partial) {
+			da_foreach (&outputs, oq) {
+				struct output *o = *oq;
+				if (o->lay.span)
+					o->conf.dirty = o->conf.resized = true;
+			}
+			break;
+		}
+	}
+
+	da_foreach (&outputs, op) {
+		struct output *out = *op;
+		int fd = out->ifd;
+		u32 sw = out->iw, sh = out->ih;
+		u64 hash = out->ihash;
+		const struct layout *lay = &out->lay;
+
+		if (!out->conf.dirty || out->conf.partial || out_asleep(out)
+		    || out->anim.ring)
+		{
+			continue;
+		}
+		if (fd == -1 && (t = target_find(out)) && !t->anim) {
+			fd = t->fd;
+			sw = t->w;
+			sh = t->h;
+			hash = t->hash;
+			lay = &t->lay;
+		} else if (!out->conf.resized)
+			continue;
+		if (fd == -1 || !(b = out_prescale(out, lay, hash, sw, sh)))
+			continue;
+		if ((src = map_image(fd, (size_t)sw * sh * sizeof(xrgb)))
+		    == MAP_FAILED)
+		{
+			b->hash = 0;
+			bcache_put(b);
+			continue;
+		}
+		da_append(&jobs, ((struct sjob){.b = b, .src = src}));
+	}
+
+	bcache_scale(jobs.buf, jobs.len);
+
+	da_foreach (&outputs, op) {
+		struct output *out = *op;
+		if (out->conf.dirty && !out->conf.partial) {
+			out_restore(out, out->conf.resized);
+			out->conf.dirty = out->conf.resized = false;
+		}
+	}
+
+	da_foreach (&jobs, j) {
+		munmap((u8 *)j->src, (size_t)j->b->sw * j->b->sh * sizeof(xrgb));
+		bcache_put(j->b);
+	}
+	free(jobs.buf);
+}
+
+void
+draw(struct output *out)
+{
+	out->buf->busy = true;
+	wl_surface_attach(out->surf, out->buf->wl_buf, 0, 0);
+	wl_surface_damage_buffer(out->surf, 0, 0, out->buf->w, out->buf->h);
+	view_apply(out);
+	wl_surface_commit(out->surf);
+
+	if (out->view.moving && !out->view.cb)
+		view_wait(out);
+}
+
+/* Scale the current image again, for example because the output woke up or
+   the buffer needs to grow to allow for zooming in further */
+void
+rescale(struct output *out)
+{
+	u8 *src;
+	size_t size = (size_t)out->iw * out->ih * sizeof(xrgb);
+
+	out->sleep.pending = false;
+	if ((src = map_image(out->ifd, size)) == MAP_FAILED)
+		return;
+	if (mkbuf(out, src))
+		draw(out);
+	munmap(src, size);
+}
+
+/* Start moving the view of an output towards ‘v’ over ‘dur’ nanoseconds */
+void
+view_set(struct output *out, struct view v, u64 dur, bool bounce)
+{
+	bool grow;
+	u32 scale = v.z * 100 + .5;
+
+	view_stop(out);
+	out->view.from = out->view.cur;
+	out->view.to = v;
+	out->view.start = pace_now();
+	out->view.dur = dur;
+	out->view.bounce = bounce;
+	out->view.moving = true;
+
+	/* The buffer must be large enough to show the image at its most zoomed
+	   in without upscaling.  It never shrinks again, so zooming back out and
+	   in again costs nothing. */
+	grow = scale > out->view.scale;
+	out->view.scale = MAX(out->view.scale, scale);
+
+	if (out->ifd == -1 || out->anim.ring)
+		return;
+	if (out_asleep(out))
+		out->sleep.pending |= grow;
+	else if (grow)
+		rescale(out);
+	else
+		view_wait(out);
+}
+
+void
+view_stop(struct output *out)
+{
+	out->view.moving = false;
+	if (out->view.cb) {
+		wl_callback_destroy(out->view.cb);
+		out->view.cb = NULL;
+	}
+}
+
+void
+view_wait(struct output *out)
+{
+	out->view.cb = wl_surface_frame(out->surf);
+	wl_callback_add_listener(out->view.cb, &view_listener, out);
+	wl_surface_commit(out->surf);
+}
+
+/* Set the source rectangle of the viewport to the current view.  Images that
+   aren’t zoomed are shown in full, as usual. */
+void
+view_apply(struct output *out)
+{
+	double w, h;
+	u32 bw, bh;
+	struct view *v = &out->view.cur;
+
+	if (!out->buf)
+		return;
+
+	/* The source rectangle is in surface coordinates, which are those of the
+	   buffer once its transform and scale are applied */
+	bw = out->buf->w;
+	bh = out->buf->h;
+	out_orient(out, &bw, &bh);
+
+	if ((bw == out->dw && bh == out->dh) || !out->vp) {
+		if (out->vp) {
+			wp_viewport_set_source(out->vp, wl_fixed_from_int(-1),
+			                       wl_fixed_from_int(-1),
+			                       wl_fixed_from_int(-1),
+			                       wl_fixed_from_int(-1));
+		}
+		out_fit(out, out->buf->w, out->buf->h);
+		return;
+	}
+
+	/* The buffer swapped in may not have been shown on this surface before,
+	   so it’s up to us to give it the transform of the output.  The viewport
+	   takes care of any scale, fractional or not. */
+	wl_surface_set_buffer_transform(out->surf, out->tform);
+	wl_surface_set_buffer_scale(out->surf, 1);
+
+	w = bw / v->z;
+	h = bh / v->z;
+	wp_viewport_set_source(out->vp, wl_fixed_from_double(v->x * (bw - w)),
+	                       wl_fixed_from_double(v->y * (bh - h)),
+	                       wl_fixed_from_double(w), wl_fixed_from_double(h));
+	wp_viewport_set_destination(out->vp, out->lw, out->lh);
+}
+
+/* Make a ‘w’×‘h’ buffer cover the surface of an output.  With a viewport we
+   simply stretch it over the surface, which also covers fractional scales;
+   without one the buffer must be the surface size times the integer scale of
+   the output. */
+void
+out_fit(struct output *out, u32 w, u32 h)
+{
+	wl_surface_set_buffer_transform(out->surf, out->tform);
+	out_orient(out, &w, &h);
+	if (!out->vp)
+		wl_surface_set_buffer_scale(out->surf, out->iscale);
+	else if (w == out->lw && h == out->lh)
+		wp_viewport_set_destination(out->vp, -1, -1);
+	else
+		wp_viewport_set_destination(out->vp, out->lw, out->lh);
+}
+
+/* Move the view one step further along.  Each step is nothing more than a new
+   source rectangle; the buffer itself is left untouched. */
+void
+view_done(void *data, wl_callback_t *cb, u32 time)
+{
+	double f;
+	u64 t;
+	struct output *out = data;
+	struct view *a = &out->view.from, *b = &out->view.to;
+
+	wl_callback_destroy(cb);
+	out->view.cb = NULL;
+
+	t = pace_predict(out);
+	f = !out->view.dur ? 1
+	  : t <= out->view.start ? 0
+	  : MIN((double)(t - out->view.start) / out->view.dur, 1);
+
+	/* Ease in and out, so that the movement doesn’t start and stop with a
+	   jolt */
+	f = f * f * (3 - 2 * f);
+	out->view.cur = (struct view){
+		.x = a->x + (b->x - a->x) * f,
+		.y = a->y + (b->y - a->y) * f,
+		.z = a->z + (b->z - a->z) * f,
+	};
+	view_apply(out);
+
+	if (f < 1)
+		view_wait(out);
+	else if (out->view.bounce) {
+		out->view.from = *b;
+		out->view.to = *a;
+		out->view.start = t;
+		view_wait(out);
+	} else {
+		out->view.moving = false;
+		wl_surface_commit(out->surf);
+	}
+}
+
+void
+anim_start(struct output *out, struct anim *a)
+{
+	u32 w = out->dw, h = out->dh;
+
+	/* An output that isn’t configured yet has no size to scale to; the
+	   animation is started by out_restore() once it is */
+	if (!out->dw || !out->dh)
+		return;
+	out_orient(out, &w, &h);
+
+	/* Views only apply to static images */
+	view_stop(out);
+
+	/* Start off in whatever tier the last animation ended up in; if the
+	   machine was struggling then, it likely still is */
+	if (out->vp && out->gov.tier >= TIER_HALFRES) {
+		w = MAX(w / 2, 1);
+		h = MAX(h / 2, 1);
+	}
+	if (!(out->anim.ring = ring_acquire(a, shm, w, h, out->tform, out->fmt,
+	                                    ring_cap)))
+	{
+		return;
+	}
+	out_fit(out, w, h);
+	out->anim.frame = 0;
+	out->anim.started = false;
+	out->anim.skip = false;
+
+	/* Don’t count the time since the last animation as a frame interval */
+	out->pace.last = 0;
+
+	if (out_asleep(out)) {
+		out_sleep(out);
+		out->sleep.deferred++;
+	} else
+		anim_draw(out, pace_predict(out));
+}
+
+void
+anim_stop(struct output *out)
+{
+	out->sleep.paused = false;
+	if (out->anim.cb) {
+		wl_callback_destroy(out->anim.cb);
+		out->anim.cb = NULL;
+	}
+	if (out->anim.ring) {
+		ring_release(out->anim.ring);
+		out->anim.ring = NULL;
+	}
+	if (out->vp) {
+		wp_viewport_set_source(out->vp, wl_fixed_from_int(-1),
+		                       wl_fixed_from_int(-1), wl_fixed_from_int(-1),
+		                       wl_fixed_from_int(-1));
+		wp_viewport_set_destination(out->vp, -1, -1);
+	}
+}
+
+/* Switch to a ring of the resolution demanded by the current quality tier.
+   Below full resolution the compositor upscales the buffer for us through the
+   viewport, which is far cheaper than us scaling every frame to full size. */
+void
+anim_tier(struct output *out)
+{
+	u32 w = out->dw, h = out->dh;
+	struct ring *r = out->anim.ring;
+
+	if (!out->vp)
+		return;
+	out_orient(out, &w, &h);
+	if (out->gov.tier >= TIER_HALFRES) {
+		w = MAX(w / 2, 1);
+		h = MAX(h / 2, 1);
+	}
+	if (r->w == w && r->h == h)
+		return;
+
+	if (!(out->anim.ring = ring_acquire(r->anim, shm, w, h, out->tform,
+	                                    out->fmt, ring_cap)))
+	{
+		out->anim.ring = r;
+		return;
+	}
+	ring_release(r);
+	out_fit(out, w, h);
+}
+
+/* Commit the current frame of the animation, which we expect to be presented
+   at the time ‘target’.  If the frame can’t be drawn yet because its slot is
+   still held by the compositor, we simply try again on the next frame
+   callback. */
+void
+anim_draw(struct output *out, u64 target)
+{
+	u64 start = pace_now();
+	enum filter f = gov_filter(&out->gov);
+	struct ring *r;
+	struct slot *s;
+
+	anim_tier(out);
+	r = out->anim.ring;
+
+	if ((s = ring_frame(r, out->anim.frame, f))) {
+		s->busy = true;
+		wl_surface_attach(out->surf, s->wl_buf, 0, 0);
+		wl_surface_damage_buffer(out->surf, 0, 0, r->w, r->h);
+		pace_feedback(out, start, target);
+	}
+	anim_wait(out);
+
+	/* Scale the following frame now while we wait, so that it is ready to go
+	   the moment its deadline comes around.  This is a no-op when every frame
+	   is already cached. */
+	if (s)
+		ring_frame(r, (out->anim.frame + 1) % r->anim->nframes, f);
+
+	gov_update(&out->gov, pace_now() - start,
+	           out->pace.refresh ? out->pace.refresh : REFRESH_DEFAULT);
+}
+
+/* Commit the surface with a new frame callback, to be woken up again at the
+   next opportunity to draw */
+void
+anim_wait(struct output *out)
+{
+	out->anim.cb = wl_surface_frame(out->surf);
+	wl_callback_add_listener(out->anim.cb, &frame_listener, out);
+	wl_surface_commit(out->surf);
+}
+
+void
+frame_done(void *data, wl_callback_t *cb, u32 time)
+{
+	u32 n;
+	u64 t;
+	struct output *out = data;
+	struct anim *a = out->anim.ring->anim;
+
+	wl_callback_destroy(cb);
+	out->anim.cb = NULL;
+
+	/* Frame callbacks only tell us that now is a good time to draw.  What we
+	   actually care about is when whatever we commit now will be shown, so
+	   that is the time we schedule frames against. */
+	t = pace_predict(out);
+
+	if (!out->anim.started) {
+		out->anim.started = true;
+		out->anim.next = t + MS(a->durs[out->anim.frame]);
+	}
+	if ((i64)(t - out->anim.next) < 0) {
+		anim_wait(out);
+		return;
+	}
+
+	/* At half rate we only ever draw on every other frame callback, giving
+	   the rendering of each frame twice as long */
+	if (out->gov.tier >= TIER_HALFRATE && (out->anim.skip = !out->anim.skip)) {
+		anim_wait(out);
+		return;
+	}
+
+	/* Skip over any frame whose time on screen would already be over by the
+	   time our commit is presented; there is no point in rendering it */
+	for (n = 0; n < a->nframes && (i64)(t - out->anim.next) >= 0; n++) {
+		out->anim.frame = (out->anim.frame + 1) % a->nframes;
+		out->anim.next += MS(a->durs[out->anim.frame]);
+	}
+	out->pace.dropped += n - 1;
+
+	/* If we’ve fallen more than an entire loop behind, resynchronize with
+	   the clock instead of rushing to catch up */
+	if (n == a->nframes)
+		out->anim.next = t + MS(a->durs[out->anim.frame]);
+
+	anim_draw(out, t);
+}
+
+u64
+pace_now(void)
+{
+	struct timespec ts;
+	clock_gettime(pres_clock, &ts);
+	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Predict at what time a commit made right now will be presented.  Without
+   presentation feedback the best we can do is to assume ‘now’. */
+u64
+pace_predict(struct output *out)
+{
+	u64 t = pace_now();
+
+	if (out->pace.last && out->pace.refresh && t > out->pace.last)
+		t += out->pace.refresh - (t - out->pace.last) % out->pace.refresh;
+	return t;
+}
+
+/* Request feedback on when the next commit is presented */
+void
+pace_feedback(struct output *out, u64 start, u64 target)
+{
+	if (!pres)
+		return;
+
+	for (size_t i = 0; i < PENDING_MAX; i++) {
+		struct pending *p = out->pace.pending + i;
+		if (!p->fb) {
+			p->fb = wp_presentation_feedback(pres, out->surf);
+			p->start = start;
+			p->target = target;
+			wp_presentation_feedback_add_listener(p->fb, &fb_listener, out);
+			return;
+		}
+	}
+}
+
+/* Remove and destroy the pending feedback ‘fb’, storing it in ‘p’ */
+bool
+pace_pop(struct output *out, wp_presentation_feedback_t *fb, struct pending *p)
+{
+	wp_presentation_feedback_destroy(fb);
+	for (size_t i = 0; i < PENDING_MAX; i++) {
+		if (out->pace.pending[i].fb == fb) {
+			*p = out->pace.pending[i];
+			out->pace.pending[i].fb = NULL;
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+fb_presented(void *data, wp_presentation_feedback_t *fb, u32 sec_hi,
+             u32 sec_lo, u32 nsec, u32 refresh, u32 seq_hi, u32 seq_lo,
+             u32 flags)
+{
+	u64 t, missed = 0;
+	struct output *out = data;
+	struct pending p;
+
+	if (!pace_pop(out, fb, &p))
+		return;
+
+	t = (((u64)sec_hi << 32) | sec_lo) * 1000000000 + nsec;
+	if (refresh)
+		out->pace.refresh = refresh;
+	if (out->pace.refresh && t > p.target)
+		missed = (t - p.target + out->pace.refresh / 2) / out->pace.refresh;
+
+	if (out->pace.last)
+		hist_add(&out->pace.interval, (t - out->pace.last) / MS(1));
+	hist_add(&out->pace.missed, missed);
+	hist_add(&out->pace.latency, (t - p.start) / MS(1));
+	out->pace.presented++;
+	out->pace.last = t;
+}
+
+void
+fb_discarded(void *data, wp_presentation_feedback_t *fb)
+{
+	struct output *out = data;
+	struct pending p;
+
+	if (pace_pop(out, fb, &p))
+		out->pace.discarded++;
+}
+
+void
+fb_sync(void *data, wp_presentation_feedback_t *fb, wl_output_t *out)
+{
+}
+
+void
+pres_clock_id(void *data, wp_presentation_t *pres, u32 clk)
+{
+	pres_clock = clk;
+}
+
+void
+reg_add(void *data, wl_registry_t *reg, u32 name, const char *iface, u32 ver)
+{
+#define assert_ver(n) \
+	if (ver < n) { \
+		diex("The v%" PRIu32 " %s interface is required, but the compositor " \
+		     "only supports v%" PRIu32, \
+		     n, iface, ver); \
+	}
+#define is(s) streq(iface, s.name)
+
+	if (is(wl_compositor_interface)) {
+		assert_ver(4);
+		comp = wl_registry_bind(reg, name, &wl_compositor_interface, 4);
+	} else if (is(wl_shm_interface)) {
+		shm = wl_registry_bind(reg, name, &wl_shm_interface, 1);
+		wl_shm_add_listener(shm, &shm_listener, NULL);
+	} else if (is(wl_output_interface)) {
+		struct output *out;
+		struct wl_output *wl_out;
+
+		assert_ver(4);
+		wl_out = wl_registry_bind(reg, name, &wl_output_interface, 4);
+		out = xmalloc(sizeof(*out));
+		*out = (struct output){
+			.wl_out = wl_out,
+			.name = name,
+			.ifd = -1,
+			.iscale = 1,
+			.fmt = WL_SHM_FORMAT_XRGB8888,
+			.view = {.scale = 100, .cur = {.x = .5, .y = .5, .z = 1}},
+		};
+		da_append(&outputs, out);
+		wl_output_add_listener(wl_out, &out_listener, out);
+		out_power(out);
+		surf_create(out);
+	} else if (is(zwlr_layer_shell_v1_interface)) {
+		assert_ver(2);
+		lshell = wl_registry_bind(reg, name, &zwlr_layer_shell_v1_interface, 2);
+	} else if (is(wp_presentation_interface)) {
+		pres = wl_registry_bind(reg, name, &wp_presentation_interface, 1);
+		wp_presentation_add_listener(pres, &pres_listener, NULL);
+	} else if (is(wp_viewporter_interface))
+		vper = wl_registry_bind(reg, name, &wp_viewporter_interface, 1);
+	else if (is(wp_fractional_scale_manager_v1_interface)) {
+		fsmgr = wl_registry_bind(reg, name,
+		                         &wp_fractional_scale_manager_v1_interface, 1);
+	}
+	else if (is(zwlr_output_power_manager_v1_interface)) {
+		pmgr = wl_registry_bind(reg, name,
+		                        &zwlr_output_power_manager_v1_interface, 1);
+		da_foreach (&outputs, op)
+			out_power(*op);
+	} else if (is(ext_idle_notifier_v1_interface)) {
+		idle_mgr = wl_registry_bind(reg, name, &ext_idle_notifier_v1_interface,
+		                            1);
+		idle_init();
+	} else if (is(wl_seat_interface) && !seat) {
+		seat = wl_registry_bind(reg, name, &wl_seat_interface, 1);
+		idle_init();
+	}
+#undef is
+#undef assert_ver
+}
+
+void
+reg_del(void *data, wl_registry_t *reg, u32 name)
+{
+	da_foreach (&outputs, op) {
+		struct output *out = *op;
+		if (out->name == name) {
+			da_remove(&outputs, op - outputs.buf);
+			out_free(out);
+
+			/* Images spanning all outputs need cutting up anew */
+			da_foreach (&outputs, oq) {
+				struct output *o = *oq;
+				if (o->lay.span) {
+					o->conf.dirty = o->conf.resized = true;
+					settle_at = pace_now() + SETTLE_DELAY;
+				}
+			}
+			return;
+		}
+	}
+}
+
+void
+out_mode(void *data, wl_output_t *wl_out, u32 flags, i32 w, i32 h, i32 fps)
+{
+	struct output *out = data;
+
+	/* Until the surface is configured the mode is our best guess at the
+	   size of the output */
+	if (!out->lw) {
+		out->dw = w;
+		out->dh = h;
+	}
+	out->conf.partial = true;
+
+	/* Presentation feedback gives us a more accurate refresh interval, but
+	   until we have some the mode’s refresh rate (in mHz) will have to do */
+	if (!out->pace.refresh && fps > 0)
+		out->pace.refresh = 1000000000000 / fps;
+}
+
+void
+out_name(void *data, wl_output_t *wl_out, const char *name)
+{
+	if (!(((struct output *)data)->human_name = strdup(name)))
+		warn("strdup: %s", name);
+}
+
+void
+out_scale(void *data, wl_output_t *wl_out, i32 scale)
+{
+	struct output *out = data;
+
+	out->iscale = MAX(scale, 1);
+	out->conf.partial = true;
+	if (out->lw)
+		out_resize(out);
+}
+
+void
+frac_scale(void *data, wp_fractional_scale_v1_t *fs, u32 scale)
+{
+	struct output *out = data;
+
+	out->fscale = scale;
+	if (out->lw)
+		out_resize(out);
+}
+
+void
+out_geom(void *data, wl_output_t *wl_out, i32 x, i32 y, i32 pw, i32 ph,
+         i32 sp, const char *make, const char *model, i32 tform)
+{
+	struct output *out = data;
+
+	/* Everything needs redrawing in the new orientation, even when turning
+	   the output around doesn’t change its size */
+	if (out->tform != (u32)tform && out->lw) {
+		out->conf.dirty = out->conf.resized = true;
+		settle_at = pace_now() + SETTLE_DELAY;
+	}
+
+	/* Moving an output only matters to images spanning all outputs, which
+	   out_settle() takes care of */
+	if ((out->x != x || out->y != y) && out->lw) {
+		out->conf.dirty = true;
+		settle_at = pace_now() + SETTLE_DELAY;
+	}
+	out->x = x;
+	out->y = y;
+	out->tform = tform;
+	out->conf.partial = true;
+}
+
+void
 out_desc(void *data, wl_output_t *out, const char *name)
 {
 }
 
+/* The compositor is done telling us about changes to an output.  If its
+   layer surface was configured in the meantime it may now be brought up to
+   date, once nothing else changes for a little while. */
 void
-out_done(void *data, wl_output_t *out)
+out_done(void *data, wl_output_t *wl_out)
 {
+	struct output *out = data;
+
+	out->conf.partial = false;
+	if (out->conf.dirty)
+		settle_at = pace_now() + SETTLE_DELAY;
 }
 
 void
@@ -500,13 +2855,62 @@ ls_conf(void *data, zwlr_layer_surface_v1_t *surf, u32 serial, u32 w, u32 h)
 
 	/* If the size of the last committed buffer has not changed, we don’t need
 	   to do anything. */
-	if (out->safe_to_draw && out->dw == w && out->dh == h)
+	if (out->safe_to_draw && out->lw == w && out->lh == h)
 		wl_surface_commit(out->surf);
 	else {
-		out->dw = w;
-		out->dh = h;
+		out->lw = w;
+		out->lh = h;
 		out->safe_to_draw = true;
+		out_resize(out);
+	}
+}
+
+/* Work out the size in pixels of an output from the size of its surface and
+   its scale, so that images are scaled exactly once, by us, to the pixels
+   actually on screen.  The new size takes effect once things settle. */
+void
+out_resize(struct output *out)
+{
+	u32 w, h, fmt;
+
+	/* Fractional sizes are rounded half away from zero, as the fractional
+	   scale protocol asks of us */
+	if (out->vp && out->fscale) {
+		w = MAX(((u64)out->lw * out->fscale + 60) / 120, 1);
+		h = MAX(((u64)out->lh * out->fscale + 60) / 120, 1);
+	} else {
+		w = out->lw * out->iscale;
+		h = out->lh * out->iscale;
+	}
+
+	fmt = out_format(out);
+	out->conf.resized |= out->dw != w || out->dh != h || out->fmt != fmt;
+	out->conf.dirty = true;
+	out->dw = w;
+	out->dh = h;
+	out->fmt = fmt;
+	settle_at = pace_now() + SETTLE_DELAY;
+}
+
+/* Get the buffer format requested for an output, falling back to XRGB8888
+   if the compositor doesn’t support it */
+u32
+out_format(struct output *out)
+{
+	u32 fmt = WL_SHM_FORMAT_XRGB8888;
+
+	da_foreach (&fmtopts, f) {
+		if (!f->name || (out->human_name && streq(f->name, out->human_name)))
+			fmt = f->fmt;
+	}
+	for (size_t i = 0; i < lengthof(formats); i++) {
+		if (formats[i].fmt == fmt && !formats[i].ok) {
+			warnx("Compositor lacks support for %s buffers; using xrgb8888",
+			      formats[i].name);
+			return WL_SHM_FORMAT_XRGB8888;
+		}
 	}
+	return fmt;
 }
 
 void
@@ -517,41 +2921,220 @@ ls_close(void *data, zwlr_layer_surface_v1_t *surf)
 	/* Don’t trust ‘output’ to be valid, in case compositor destroyed if
 	   before calling closed() */
 	da_foreach (&outputs, p) {
-		if (out->name == p->name) {
+		if (*p == out) {
 			out_layer_free(out);
 			return;
 		}
 	}
 }
 
-/* Unused; all wayland compositors must support XRGB8888 */
+/* Note which of the formats we know of the compositor supports */
 void
 shm_fmt(void *data, wl_shm_t *shm, u32 fmt)
 {
+	for (size_t i = 0; i < lengthof(formats); i++) {
+		if (formats[i].fmt == fmt)
+			formats[i].ok = true;
+	}
+}
+
+/* Watch the power state of an output, if the compositor lets us */
+void
+out_power(struct output *out)
+{
+	if (!pmgr || out->sleep.power)
+		return;
+	out->sleep.power = zwlr_output_power_manager_v1_get_output_power(
+		pmgr, out->wl_out);
+	zwlr_output_power_v1_add_listener(out->sleep.power, &power_listener, out);
+}
+
+void
+power_mode(void *data, zwlr_output_power_v1_t *power, u32 mode)
+{
+	struct output *out = data;
+
+	if ((out->sleep.off = mode == ZWLR_OUTPUT_POWER_V1_MODE_OFF))
+		out_sleep(out);
+	else
+		out_wake(out);
+}
+
+/* Another client may have exclusive control over the power state, in which
+   case we can only assume that the output is on */
+void
+power_failed(void *data, zwlr_output_power_v1_t *power)
+{
+	struct output *out = data;
+
+	zwlr_output_power_v1_destroy(power);
+	out->sleep.power = NULL;
+	out->sleep.off = false;
+	out_wake(out);
+}
+
+void
+idle_init(void)
+{
+	if (!idle_mgr || !seat || !idle_timeout || idle_note)
+		return;
+	idle_note = ext_idle_notifier_v1_get_idle_notification(
+		idle_mgr, idle_timeout * 1000, seat);
+	ext_idle_notification_v1_add_listener(idle_note, &idle_listener, NULL);
+}
+
+void
+idle_idled(void *data, ext_idle_notification_v1_t *note)
+{
+	idle = true;
+	da_foreach (&outputs, op)
+		out_sleep(*op);
+}
+
+void
+idle_resumed(void *data, ext_idle_notification_v1_t *note)
+{
+	idle = false;
+	da_foreach (&outputs, op)
+		out_wake(*op);
+}
+
+bool
+out_asleep(struct output *out)
+{
+	return out->sleep.off || idle;
+}
+
+/* Pause the animation on an output by no longer requesting frame callbacks */
+void
+out_sleep(struct output *out)
+{
+	/* A moving view simply carries on from wherever it should be by the
+	   time we wake up */
+	if (out->view.cb) {
+		wl_callback_destroy(out->view.cb);
+		out->view.cb = NULL;
+	}
+
+	if (!out->anim.ring || out->sleep.paused)
+		return;
+	if (out->anim.cb) {
+		wl_callback_destroy(out->anim.cb);
+		out->anim.cb = NULL;
+	}
+	out->sleep.paused = true;
+	out->sleep.since = pace_now();
+}
+
+/* Resume whatever work was put off while the output was asleep.  Frames that
+   would have been shown in the meantime are counted as skipped, and playback
+   picks up where it left off. */
+void
+out_wake(struct output *out)
+{
+	if (out_asleep(out) || !out->surf)
+		return;
+
+	if (out->sleep.paused) {
+		u64 loop = 0;
+		struct anim *a = out->anim.ring->anim;
+
+		for (u32 i = 0; i < a->nframes; i++)
+			loop += MS(a->durs[i]);
+		if (loop)
+			out->sleep.skipped +=
+				(pace_now() - out->sleep.since) * a->nframes / loop;
+
+		out->sleep.paused = false;
+		out->anim.started = false;
+		out->pace.last = 0;
+		anim_draw(out, pace_predict(out));
+	}
+
+	if (out->sleep.pending)
+		rescale(out);
+	else if (out->view.moving && !out->view.cb && out->ifd != -1)
+		view_wait(out);
+}
+
+/* Drop the current image, including one still waiting for the output to wake
+   up */
+void
+out_unset(struct output *out)
+{
+	out->sleep.pending = false;
+	out->lay = (struct layout){0};
+	if (out->ifd != -1) {
+		close(out->ifd);
+		out->ifd = -1;
+	}
+	if (out->lyr.base)
+		lyr_stop(out);
+	upd_free(out);
+	if (out->buf) {
+		bcache_put(out->buf);
+		out->buf = NULL;
+	}
+}
+
+/* Forget the buffers used to update the current image.  The current buffer
+   itself is left to the caller. */
+void
+upd_free(struct output *out)
+{
+	if (out->upd.back) {
+		bcache_put(out->upd.back);
+		out->upd.back = NULL;
+	}
+	out->upd.own = false;
+	out->upd.stale.len = 0;
 }
 
 void
 out_layer_free(struct output *out)
 {
+	anim_stop(out);
+	view_stop(out);
+	out_unset(out);
+	for (size_t i = 0; i < PENDING_MAX; i++) {
+		if (out->pace.pending[i].fb) {
+			wp_presentation_feedback_destroy(out->pace.pending[i].fb);
+			out->pace.pending[i].fb = NULL;
+		}
+	}
 	if (out->layer) {
 		zwlr_layer_surface_v1_destroy(out->layer);
 		out->layer = NULL;
 	}
+	if (out->vp) {
+		wp_viewport_destroy(out->vp);
+		out->vp = NULL;
+	}
+	if (out->fs) {
+		wp_fractional_scale_v1_destroy(out->fs);
+		out->fs = NULL;
+	}
 	if (out->surf) {
 		wl_surface_destroy(out->surf);
 		out->surf = NULL;
 	}
 
-	out->name = 0;
 	out->safe_to_draw = false;
 }
 
+/* Free an output along with everything it holds on to */
 void
-buf_free(void *data, wl_buffer_t *wl_buf)
+out_free(struct output *out)
 {
-	struct output *out = data;
-	wl_buffer_destroy(out->wl_buf);
-	munmap(out->buf.p, out->buf.size);
+	out_layer_free(out);
+	if (out->sleep.power)
+		zwlr_output_power_v1_destroy(out->sleep.power);
+	if (out->wl_out)
+		wl_output_release(out->wl_out);
+	lyr_free(out);
+	free(out->human_name);
+	free(out->upd.stale.buf);
+	free(out);
 }
 
 void
@@ -559,15 +3142,36 @@ cleanup(void)
 {
 	if (sock_bound)
 		unlink(ewd_sock_path());
-	da_foreach (&outputs, out) {
-		if (out->wl_out)
-			wl_output_release(out->wl_out);
-		out_layer_free(out);
-		free(out->human_name);
-	}
+	da_foreach (&outputs, op)
+		out_free(*op);
 	free(outputs.buf);
+	da_foreach (&fmtopts, f)
+		free(f->name);
+	free(fmtopts.buf);
+	da_foreach (&preloads, p)
+		preload_free(*p);
+	free(preloads.buf);
+	da_foreach (&targets, t)
+		target_free(t);
+	free(targets.buf);
+	zjob_free();
+	bcache_free();
 	if (lshell)
 		zwlr_layer_shell_v1_destroy(lshell);
+	if (pres)
+		wp_presentation_destroy(pres);
+	if (vper)
+		wp_viewporter_destroy(vper);
+	if (fsmgr)
+		wp_fractional_scale_manager_v1_destroy(fsmgr);
+	if (pmgr)
+		zwlr_output_power_manager_v1_destroy(pmgr);
+	if (idle_note)
+		ext_idle_notification_v1_destroy(idle_note);
+	if (idle_mgr)
+		ext_idle_notifier_v1_destroy(idle_mgr);
+	if (seat)
+		wl_seat_destroy(seat);
 	if (shm)
 		wl_shm_destroy(shm);
 	if (comp)
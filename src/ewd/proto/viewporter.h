@@ -0,0 +1,295 @@
+/* Generated by wayland-scanner 1.22.0 */
+
+#ifndef VIEWPORTER_CLIENT_PROTOCOL_H
+#define VIEWPORTER_CLIENT_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wayland-client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct wl_surface;
+struct wp_viewport;
+struct wp_viewporter;
+
+#ifndef WP_VIEWPORTER_INTERFACE
+#	define WP_VIEWPORTER_INTERFACE
+/**
+ * @page page_iface_wp_viewporter wp_viewporter
+ * @section page_iface_wp_viewporter_desc Description
+ *
+ * surface cropping and scaling
+ *
+ * The global interface exposing surface cropping and scaling
+ * capabilities is used to instantiate an interface extension for a
+ * wl_surface object. This extended interface will then allow
+ * cropping and scaling the surface contents, effectively
+ * disconnecting the direct relationship between the buffer and the
+ * surface size.
+ */
+/**
+ * @defgroup iface_wp_viewporter The wp_viewporter interface
+ *
+ * surface cropping and scaling
+ *
+ * The global interface exposing surface cropping and scaling
+ * capabilities is used to instantiate an interface extension for a
+ * wl_surface object. This extended interface will then allow
+ * cropping and scaling the surface contents, effectively
+ * disconnecting the direct relationship between the buffer and the
+ * surface size.
+ */
+extern const struct wl_interface wp_viewporter_interface;
+#endif
+
+#ifndef WP_VIEWPORT_INTERFACE
+#	define WP_VIEWPORT_INTERFACE
+/**
+ * @page page_iface_wp_viewport wp_viewport
+ * @section page_iface_wp_viewport_desc Description
+ *
+ * crop and scale interface to a wl_surface
+ *
+ * An interface to crop and scale a wl_surface. The source rectangle
+ * is applied first and the destination size second.
+ *
+ * The source rectangle and destination size are double-buffered
+ * state, applied on the next wl_surface.commit.
+ */
+/**
+ * @defgroup iface_wp_viewport The wp_viewport interface
+ *
+ * crop and scale interface to a wl_surface
+ *
+ * An interface to crop and scale a wl_surface. The source rectangle
+ * is applied first and the destination size second.
+ *
+ * The source rectangle and destination size are double-buffered
+ * state, applied on the next wl_surface.commit.
+ */
+extern const struct wl_interface wp_viewport_interface;
+#endif
+
+#ifndef WP_VIEWPORTER_ERROR_ENUM
+#	define WP_VIEWPORTER_ERROR_ENUM
+enum wp_viewporter_error {
+	/**
+	 * the surface already has a viewport object associated
+	 */
+	WP_VIEWPORTER_ERROR_VIEWPORT_EXISTS = 0,
+};
+#endif /* WP_VIEWPORTER_ERROR_ENUM */
+
+#define WP_VIEWPORTER_DESTROY      0
+#define WP_VIEWPORTER_GET_VIEWPORT 1
+
+/**
+ * @ingroup iface_wp_viewporter
+ */
+#define WP_VIEWPORTER_DESTROY_SINCE_VERSION 1
+/**
+ * @ingroup iface_wp_viewporter
+ */
+#define WP_VIEWPORTER_GET_VIEWPORT_SINCE_VERSION 1
+
+/**
+ * @ingroup iface_wp_viewporter
+ */
+static inline void
+wp_viewporter_set_user_data(
+	struct wp_viewporter *wp_viewporter, void *user_data)
+{
+	wl_proxy_set_user_data((struct wl_proxy *)wp_viewporter, user_data);
+}
+
+/**
+ * @ingroup iface_wp_viewporter
+ */
+static inline void *
+wp_viewporter_get_user_data(struct wp_viewporter *wp_viewporter)
+{
+	return wl_proxy_get_user_data((struct wl_proxy *)wp_viewporter);
+}
+
+static inline uint32_t
+wp_viewporter_get_version(struct wp_viewporter *wp_viewporter)
+{
+	return wl_proxy_get_version((struct wl_proxy *)wp_viewporter);
+}
+
+/**
+ * @ingroup iface_wp_viewporter
+ *
+ * unbind from the cropping and scaling interface
+ *
+ * Informs the server that the client will not be using this
+ * protocol object anymore. This does not affect any other objects,
+ * wp_viewport objects included.
+ */
+static inline void
+wp_viewporter_destroy(struct wp_viewporter *wp_viewporter)
+{
+	wl_proxy_marshal_flags(
+		(struct wl_proxy *)wp_viewporter, WP_VIEWPORTER_DESTROY, NULL,
+		wl_proxy_get_version((struct wl_proxy *)wp_viewporter),
+		WL_MARSHAL_FLAG_DESTROY);
+}
+
+/**
+ * @ingroup iface_wp_viewporter
+ *
+ * extend surface interface for crop and scale
+ *
+ * Instantiate an interface extension for the given wl_surface to
+ * crop and scale its content. If the given wl_surface already has
+ * a wp_viewport object associated, the viewport_exists
+ * protocol error is raised.
+ */
+static inline struct wp_viewport *
+wp_viewporter_get_viewport(
+	struct wp_viewporter *wp_viewporter, struct wl_surface *surface)
+{
+	struct wl_proxy *id;
+
+	id = wl_proxy_marshal_flags(
+		(struct wl_proxy *)wp_viewporter, WP_VIEWPORTER_GET_VIEWPORT,
+		&wp_viewport_interface,
+		wl_proxy_get_version((struct wl_proxy *)wp_viewporter), 0, NULL,
+		surface);
+
+	return (struct wp_viewport *)id;
+}
+
+#ifndef WP_VIEWPORT_ERROR_ENUM
+#	define WP_VIEWPORT_ERROR_ENUM
+enum wp_viewport_error {
+	/**
+	 * negative or zero values in width or height
+	 */
+	WP_VIEWPORT_ERROR_BAD_VALUE = 0,
+	/**
+	 * destination size is not integer
+	 */
+	WP_VIEWPORT_ERROR_BAD_SIZE = 1,
+	/**
+	 * source rectangle extends outside of the content area
+	 */
+	WP_VIEWPORT_ERROR_OUT_OF_BUFFER = 2,
+	/**
+	 * the wl_surface was destroyed
+	 */
+	WP_VIEWPORT_ERROR_NO_SURFACE = 3,
+};
+#endif /* WP_VIEWPORT_ERROR_ENUM */
+
+#define WP_VIEWPORT_DESTROY         0
+#define WP_VIEWPORT_SET_SOURCE      1
+#define WP_VIEWPORT_SET_DESTINATION 2
+
+/**
+ * @ingroup iface_wp_viewport
+ */
+#define WP_VIEWPORT_DESTROY_SINCE_VERSION 1
+/**
+ * @ingroup iface_wp_viewport
+ */
+#define WP_VIEWPORT_SET_SOURCE_SINCE_VERSION 1
+/**
+ * @ingroup iface_wp_viewport
+ */
+#define WP_VIEWPORT_SET_DESTINATION_SINCE_VERSION 1
+
+/**
+ * @ingroup iface_wp_viewport
+ */
+static inline void
+wp_viewport_set_user_data(struct wp_viewport *wp_viewport, void *user_data)
+{
+	wl_proxy_set_user_data((struct wl_proxy *)wp_viewport, user_data);
+}
+
+/**
+ * @ingroup iface_wp_viewport
+ */
+static inline void *
+wp_viewport_get_user_data(struct wp_viewport *wp_viewport)
+{
+	return wl_proxy_get_user_data((struct wl_proxy *)wp_viewport);
+}
+
+static inline uint32_t
+wp_viewport_get_version(struct wp_viewport *wp_viewport)
+{
+	return wl_proxy_get_version((struct wl_proxy *)wp_viewport);
+}
+
+/**
+ * @ingroup iface_wp_viewport
+ *
+ * remove scaling and cropping from the surface
+ *
+ * The associated wl_surface's crop and scale state is removed.
+ * The change is applied on the next wl_surface.commit.
+ */
+static inline void
+wp_viewport_destroy(struct wp_viewport *wp_viewport)
+{
+	wl_proxy_marshal_flags(
+		(struct wl_proxy *)wp_viewport, WP_VIEWPORT_DESTROY, NULL,
+		wl_proxy_get_version((struct wl_proxy *)wp_viewport),
+		WL_MARSHAL_FLAG_DESTROY);
+}
+
+/**
+ * @ingroup iface_wp_viewport
+ *
+ * set the source rectangle for cropping
+ *
+ * Set the source rectangle of the associated wl_surface. See
+ * wp_viewport for the description, and relation to the wl_buffer
+ * size.
+ *
+ * If all of x, y, width and height are -1.0, the source rectangle is
+ * unset instead.
+ */
+static inline void
+wp_viewport_set_source(
+	struct wp_viewport *wp_viewport, wl_fixed_t x, wl_fixed_t y,
+	wl_fixed_t width, wl_fixed_t height)
+{
+	wl_proxy_marshal_flags(
+		(struct wl_proxy *)wp_viewport, WP_VIEWPORT_SET_SOURCE, NULL,
+		wl_proxy_get_version((struct wl_proxy *)wp_viewport), 0, x, y, width,
+		height);
+}
+
+/**
+ * @ingroup iface_wp_viewport
+ *
+ * set the surface size for scaling
+ *
+ * Set the destination size of the associated wl_surface. See
+ * wp_viewport for the description, and relation to the wl_buffer
+ * size.
+ *
+ * If width is -1 and height is -1, the destination size is unset
+ * instead.
+ */
+static inline void
+wp_viewport_set_destination(
+	struct wp_viewport *wp_viewport, int32_t width, int32_t height)
+{
+	wl_proxy_marshal_flags(
+		(struct wl_proxy *)wp_viewport, WP_VIEWPORT_SET_DESTINATION, NULL,
+		wl_proxy_get_version((struct wl_proxy *)wp_viewport), 0, width, height);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
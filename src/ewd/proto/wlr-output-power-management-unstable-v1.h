@@ -0,0 +1,305 @@
+/* Generated by wayland-scanner 1.22.0 */
+
+#ifndef WLR_OUTPUT_POWER_MANAGEMENT_UNSTABLE_V1_CLIENT_PROTOCOL_H
+#define WLR_OUTPUT_POWER_MANAGEMENT_UNSTABLE_V1_CLIENT_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wayland-client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct wl_output;
+struct zwlr_output_power_manager_v1;
+struct zwlr_output_power_v1;
+
+#ifndef ZWLR_OUTPUT_POWER_MANAGER_V1_INTERFACE
+#	define ZWLR_OUTPUT_POWER_MANAGER_V1_INTERFACE
+/**
+ * @page page_iface_zwlr_output_power_manager_v1 zwlr_output_power_manager_v1
+ * @section page_iface_zwlr_output_power_manager_v1_desc Description
+ *
+ * manager to create per-output power management
+ *
+ * This interface is a manager that allows creating per-output power
+ * management mode controls.
+ */
+/**
+ * @defgroup iface_zwlr_output_power_manager_v1 The zwlr_output_power_manager_v1 interface
+ *
+ * manager to create per-output power management
+ *
+ * This interface is a manager that allows creating per-output power
+ * management mode controls.
+ */
+extern const struct wl_interface zwlr_output_power_manager_v1_interface;
+#endif
+
+#ifndef ZWLR_OUTPUT_POWER_V1_INTERFACE
+#	define ZWLR_OUTPUT_POWER_V1_INTERFACE
+/**
+ * @page page_iface_zwlr_output_power_v1 zwlr_output_power_v1
+ * @section page_iface_zwlr_output_power_v1_desc Description
+ *
+ * adjust power management mode for an output
+ *
+ * This object offers requests to set the power management mode of
+ * an output.
+ */
+/**
+ * @defgroup iface_zwlr_output_power_v1 The zwlr_output_power_v1 interface
+ *
+ * adjust power management mode for an output
+ *
+ * This object offers requests to set the power management mode of
+ * an output.
+ */
+extern const struct wl_interface zwlr_output_power_v1_interface;
+#endif
+
+#define ZWLR_OUTPUT_POWER_MANAGER_V1_GET_OUTPUT_POWER 0
+#define ZWLR_OUTPUT_POWER_MANAGER_V1_DESTROY          1
+
+/**
+ * @ingroup iface_zwlr_output_power_manager_v1
+ */
+#define ZWLR_OUTPUT_POWER_MANAGER_V1_GET_OUTPUT_POWER_SINCE_VERSION 1
+/**
+ * @ingroup iface_zwlr_output_power_manager_v1
+ */
+#define ZWLR_OUTPUT_POWER_MANAGER_V1_DESTROY_SINCE_VERSION 1
+
+/**
+ * @ingroup iface_zwlr_output_power_manager_v1
+ */
+static inline void
+zwlr_output_power_manager_v1_set_user_data(
+	struct zwlr_output_power_manager_v1 *zwlr_output_power_manager_v1,
+	void *user_data)
+{
+	wl_proxy_set_user_data((struct wl_proxy *)zwlr_output_power_manager_v1, user_data);
+}
+
+/**
+ * @ingroup iface_zwlr_output_power_manager_v1
+ */
+static inline void *
+zwlr_output_power_manager_v1_get_user_data(
+	struct zwlr_output_power_manager_v1 *zwlr_output_power_manager_v1)
+{
+	return wl_proxy_get_user_data((struct wl_proxy *)zwlr_output_power_manager_v1);
+}
+
+static inline uint32_t
+zwlr_output_power_manager_v1_get_version(
+	struct zwlr_output_power_manager_v1 *zwlr_output_power_manager_v1)
+{
+	return wl_proxy_get_version((struct wl_proxy *)zwlr_output_power_manager_v1);
+}
+
+/**
+ * @ingroup iface_zwlr_output_power_manager_v1
+ *
+ * get a power management for an output
+ *
+ * Create an output power management mode control that can be used to
+ * adjust the power management mode for a given output.
+ */
+static inline struct zwlr_output_power_v1 *
+zwlr_output_power_manager_v1_get_output_power(
+	struct zwlr_output_power_manager_v1 *zwlr_output_power_manager_v1,
+	struct wl_output *output)
+{
+	struct wl_proxy *id;
+
+	id = wl_proxy_marshal_flags(
+		(struct wl_proxy *)zwlr_output_power_manager_v1,
+		ZWLR_OUTPUT_POWER_MANAGER_V1_GET_OUTPUT_POWER,
+		&zwlr_output_power_v1_interface,
+		wl_proxy_get_version((struct wl_proxy *)zwlr_output_power_manager_v1),
+		0, NULL, output);
+
+	return (struct zwlr_output_power_v1 *)id;
+}
+
+/**
+ * @ingroup iface_zwlr_output_power_manager_v1
+ *
+ * destroy the manager
+ *
+ * All objects created by the manager will still remain valid, until their
+ * appropriate destroy request has been called.
+ */
+static inline void
+zwlr_output_power_manager_v1_destroy(
+	struct zwlr_output_power_manager_v1 *zwlr_output_power_manager_v1)
+{
+	wl_proxy_marshal_flags(
+		(struct wl_proxy *)zwlr_output_power_manager_v1,
+		ZWLR_OUTPUT_POWER_MANAGER_V1_DESTROY, NULL,
+		wl_proxy_get_version((struct wl_proxy *)zwlr_output_power_manager_v1),
+		WL_MARSHAL_FLAG_DESTROY);
+}
+
+#ifndef ZWLR_OUTPUT_POWER_V1_MODE_ENUM
+#	define ZWLR_OUTPUT_POWER_V1_MODE_ENUM
+enum zwlr_output_power_v1_mode {
+	/**
+	 * Output is turned off.
+	 */
+	ZWLR_OUTPUT_POWER_V1_MODE_OFF = 0,
+	/**
+	 * Output is turned on, no power saving
+	 */
+	ZWLR_OUTPUT_POWER_V1_MODE_ON = 1,
+};
+#endif /* ZWLR_OUTPUT_POWER_V1_MODE_ENUM */
+
+#ifndef ZWLR_OUTPUT_POWER_V1_ERROR_ENUM
+#	define ZWLR_OUTPUT_POWER_V1_ERROR_ENUM
+enum zwlr_output_power_v1_error {
+	/**
+	 * nonexistent power save mode
+	 */
+	ZWLR_OUTPUT_POWER_V1_ERROR_INVALID_MODE = 1,
+};
+#endif /* ZWLR_OUTPUT_POWER_V1_ERROR_ENUM */
+
+/**
+ * @ingroup iface_zwlr_output_power_v1
+ * @struct zwlr_output_power_v1_listener
+ */
+struct zwlr_output_power_v1_listener {
+	/**
+	 * Report a power management mode change
+	 *
+	 * Report the power management mode change of an output.
+	 *
+	 * The mode event is sent after an output changed its power
+	 * management mode. The reason can be a client using set_mode or the
+	 * compositor deciding to change an output's mode.
+	 * This event is also sent immediately when the object is created
+	 * so the client is informed about the current power management mode.
+	 */
+	void (*mode)(void *data, struct zwlr_output_power_v1 *zwlr_output_power_v1,
+	             uint32_t mode);
+	/**
+	 * object no longer valid
+	 *
+	 * This event indicates that the output power management mode control
+	 * is no longer valid. This can happen for a number of reasons,
+	 * including:
+	 * - The output doesn't support power management
+	 * - Another client already has exclusive power management mode control
+	 * for this output
+	 * - The output disappeared
+	 *
+	 * Upon receiving this event, the client should destroy this object.
+	 */
+	void (*failed)(void *data,
+	               struct zwlr_output_power_v1 *zwlr_output_power_v1);
+};
+
+/**
+ * @ingroup iface_zwlr_output_power_v1
+ */
+static inline int
+zwlr_output_power_v1_add_listener(
+	struct zwlr_output_power_v1 *zwlr_output_power_v1,
+	const struct zwlr_output_power_v1_listener *listener, void *data)
+{
+	return wl_proxy_add_listener((struct wl_proxy *)zwlr_output_power_v1,
+	                             (void (**)(void))listener, data);
+}
+
+#define ZWLR_OUTPUT_POWER_V1_SET_MODE 0
+#define ZWLR_OUTPUT_POWER_V1_DESTROY  1
+
+/**
+ * @ingroup iface_zwlr_output_power_v1
+ */
+#define ZWLR_OUTPUT_POWER_V1_MODE_SINCE_VERSION 1
+/**
+ * @ingroup iface_zwlr_output_power_v1
+ */
+#define ZWLR_OUTPUT_POWER_V1_FAILED_SINCE_VERSION 1
+
+/**
+ * @ingroup iface_zwlr_output_power_v1
+ */
+#define ZWLR_OUTPUT_POWER_V1_SET_MODE_SINCE_VERSION 1
+/**
+ * @ingroup iface_zwlr_output_power_v1
+ */
+#define ZWLR_OUTPUT_POWER_V1_DESTROY_SINCE_VERSION 1
+
+/**
+ * @ingroup iface_zwlr_output_power_v1
+ */
+static inline void
+zwlr_output_power_v1_set_user_data(
+	struct zwlr_output_power_v1 *zwlr_output_power_v1, void *user_data)
+{
+	wl_proxy_set_user_data((struct wl_proxy *)zwlr_output_power_v1, user_data);
+}
+
+/**
+ * @ingroup iface_zwlr_output_power_v1
+ */
+static inline void *
+zwlr_output_power_v1_get_user_data(
+	struct zwlr_output_power_v1 *zwlr_output_power_v1)
+{
+	return wl_proxy_get_user_data((struct wl_proxy *)zwlr_output_power_v1);
+}
+
+static inline uint32_t
+zwlr_output_power_v1_get_version(
+	struct zwlr_output_power_v1 *zwlr_output_power_v1)
+{
+	return wl_proxy_get_version((struct wl_proxy *)zwlr_output_power_v1);
+}
+
+/**
+ * @ingroup iface_zwlr_output_power_v1
+ *
+ * Set an outputs power save mode
+ *
+ * Set an output's power save mode to the given mode. The mode change
+ * is effective immediately. If the output does not support the given
+ * mode a failed event is sent.
+ */
+static inline void
+zwlr_output_power_v1_set_mode(
+	struct zwlr_output_power_v1 *zwlr_output_power_v1, uint32_t mode)
+{
+	wl_proxy_marshal_flags(
+		(struct wl_proxy *)zwlr_output_power_v1, ZWLR_OUTPUT_POWER_V1_SET_MODE,
+		NULL, wl_proxy_get_version((struct wl_proxy *)zwlr_output_power_v1), 0,
+		mode);
+}
+
+/**
+ * @ingroup iface_zwlr_output_power_v1
+ *
+ * destroy this power management
+ *
+ * Destroys the output power management mode control object.
+ */
+static inline void
+zwlr_output_power_v1_destroy(struct zwlr_output_power_v1 *zwlr_output_power_v1)
+{
+	wl_proxy_marshal_flags(
+		(struct wl_proxy *)zwlr_output_power_v1, ZWLR_OUTPUT_POWER_V1_DESTROY,
+		NULL, wl_proxy_get_version((struct wl_proxy *)zwlr_output_power_v1),
+		WL_MARSHAL_FLAG_DESTROY);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
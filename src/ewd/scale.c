@@ -1,32 +1,379 @@
 #include <sys/param.h>
 
 #include <stddef.h>
+#include <string.h>
 
 #include <pixman.h>
+#include <wayland-client-protocol.h>
 
 #include "common.h"
+#include "scale.h"
 
+/* Number of rows composed at a time.  All layers are drawn over a strip of
+   rows before moving on to the next, so that the strip stays in the cache
+   rather than being read back from memory once per layer. */
+#define STRIP_ROWS 8
+
+static pixman_format_code_t fmt_pixman(u32);
+static void orient(pixman_f_transform_t *, u32, u32, u32);
+static pixman_box32_t to_buffer(const pixman_f_transform_t *, double, double,
+                                double, double, u32, u32);
+
+static const pixman_filter_t filters[] = {
+	[FILTER_BEST] = PIXMAN_FILTER_BEST,
+	[FILTER_BILINEAR] = PIXMAN_FILTER_BILINEAR,
+	[FILTER_NEAREST] = PIXMAN_FILTER_NEAREST,
+};
+
+/* Get the number of bytes per pixel of the wl_shm format ‘fmt’ */
+size_t
+fmt_bpp(u32 fmt)
+{
+	return fmt == WL_SHM_FORMAT_RGB565 ? 2 : 4;
+}
+
+/* Scale the ‘sw’×‘sh’ image ‘src’ into the ‘dw’×‘dh’ buffer ‘dst’ of the
+   wl_shm format ‘fmt’, which is shown on an output with the wl_output
+   transform ‘t’.  The image is scaled as it should appear on screen and drawn
+   into the buffer in the native orientation of the panel, so that the
+   compositor can use the buffer as is.  The rotation costs nothing as it is
+   simply part of the pixman transform.
+
+   The image is placed as ‘pl’ says, or if that is NULL centered and scaled
+   to cover the buffer, cropping whatever doesn’t fit.  Only the part of the
+   buffer that the image covers goes through the filter; the rest is filled
+   with a solid colour, which pixman does with its SIMD fill routines.
+
+   Formats with fewer than 8 bits per channel are dithered as they’re written
+   so that gradients don’t band.  Pixman does so while it converts each
+   scaled pixel, so this too comes at little extra cost. */
 void
-scale(u8 *restrict dst, u32 dw, u32 dh, const u8 *restrict src, u32 sw, u32 sh)
+scale(u8 *restrict dst, u32 dw, u32 dh, u32 fmt, u32 t, const u8 *restrict src,
+      u32 sw, u32 sh, const struct place *pl, enum filter f)
 {
-	double s;
+	int n = 0;
+	double k, sx, sy;
+	u32 w = dw, h = dh;
+	struct place fill;
+	pixman_box32_t vis = {0, 0, dw, dh}, bars[4];
 	pixman_image_t *simg, *dimg;
 	pixman_transform_t tfrm;
-	pixman_f_transform_t ftfrm;
+	pixman_f_transform_t ftfrm, otfrm;
+
+	/* Size of the buffer as it appears on screen */
+	if (TFORM_SWAPS(t)) {
+		w = dh;
+		h = dw;
+	}
 
 	simg = pixman_image_create_bits(PIXMAN_x8r8g8b8, sw, sh, (u32 *)src,
 	                                sw * sizeof(xrgb));
-	pixman_image_set_filter(simg, PIXMAN_FILTER_BEST, NULL, 0);
+	pixman_image_set_filter(simg, filters[f], NULL, 0);
 
-	s = MAX((double)sw / dw, (double)sh / dh);
+	/* Scale by the larger of the two factors to cover the buffer, and
+	   center the image so that it’s cropped evenly on both sides */
+	if (!pl) {
+		k = MAX((double)w / sw, (double)h / sh);
+		fill = (struct place){
+			.w = sw * k / w,
+			.h = sh * k / h,
+		};
+		fill.x = (1 - fill.w) / 2;
+		fill.y = (1 - fill.h) / 2;
+		pl = &fill;
+	}
+	sx = sw / (pl->w * w);
+	sy = sh / (pl->h * h);
 
-	pixman_f_transform_init_scale(&ftfrm, s, s);
+	/* Map buffer coordinates to on-screen coordinates, then those to source
+	   coordinates */
+	orient(&otfrm, t, w, h);
+
+	pixman_f_transform_init_scale(&ftfrm, sx, sy);
+	ftfrm.m[0][2] = -pl->x * w * sx;
+	ftfrm.m[1][2] = -pl->y * h * sy;
+	if (pl->tile)
+		pixman_image_set_repeat(simg, PIXMAN_REPEAT_NORMAL);
+	else {
+		/* Pad rather than fade out the edges of the image where they meet
+		   the bars */
+		pixman_image_set_repeat(simg, PIXMAN_REPEAT_PAD);
+		vis = to_buffer(&otfrm, pl->x * w, pl->y * h, (pl->x + pl->w) * w,
+		                (pl->y + pl->h) * h, w, h);
+	}
+	pixman_f_transform_multiply(&ftfrm, &ftfrm, &otfrm);
 	pixman_transform_from_pixman_f_transform(&tfrm, &ftfrm);
 	pixman_image_set_transform(simg, &tfrm);
-	dimg = pixman_image_create_bits(PIXMAN_x8r8g8b8, dw, dh, (u32 *)dst,
-	                                dw * sizeof(xrgb));
-	pixman_image_composite(PIXMAN_OP_OVER, simg, NULL, dimg, s, s, 0, 0, 0, 0,
-	                       dw, dh);
+
+	dimg = pixman_image_create_bits(fmt_pixman(fmt), dw, dh, (u32 *)dst,
+	                                dw * fmt_bpp(fmt));
+	if (fmt == WL_SHM_FORMAT_RGB565)
+		pixman_image_set_dither(dimg, PIXMAN_DITHER_ORDERED_BAYER_8);
+	if (vis.x1 < vis.x2 && vis.y1 < vis.y2) {
+		pixman_image_composite32(PIXMAN_OP_SRC, simg, NULL, dimg, vis.x1,
+		                         vis.y1, 0, 0, vis.x1, vis.y1,
+		                         vis.x2 - vis.x1, vis.y2 - vis.y1);
+	} else
+		vis = (pixman_box32_t){0, 0, 0, 0};
+
+	/* Fill whatever is left above, below, left and right of the image */
+	if (!pl->tile) {
+		pixman_color_t c = {
+			.red = (pl->bg >> 16 & 0xFF) * 0x101,
+			.green = (pl->bg >> 8 & 0xFF) * 0x101,
+			.blue = (pl->bg & 0xFF) * 0x101,
+			.alpha = 0xFFFF,
+		};
+
+		if (vis.y1 > 0)
+			bars[n++] = (pixman_box32_t){0, 0, dw, vis.y1};
+		if (vis.y2 < (i32)dh)
+			bars[n++] = (pixman_box32_t){0, vis.y2, dw, dh};
+		if (vis.x1 > 0)
+			bars[n++] = (pixman_box32_t){0, vis.y1, vis.x1, vis.y2};
+		if (vis.x2 < (i32)dw)
+			bars[n++] = (pixman_box32_t){vis.x2, vis.y1, dw, vis.y2};
+		pixman_image_fill_boxes(PIXMAN_OP_SRC, dimg, &c, n, bars);
+	}
+
 	pixman_image_unref(simg);
 	pixman_image_unref(dimg);
 }
+
+/* Draw the image ‘src’ unscaled into the ‘dw’×‘dh’ buffer ‘dst’ of the
+   wl_shm format ‘fmt’, shown on an output with the wl_output transform ‘t’,
+   such that it covers the on-screen rectangle ‘r’, which must lie within the
+   buffer.  The rows of the image are ‘stride’ pixels apart.  We return the
+   rectangle of the buffer that was drawn to, which differs from ‘r’ on
+   rotated outputs. */
+struct rect
+patch(u8 *restrict dst, u32 dw, u32 dh, u32 fmt, u32 t, const u8 *restrict src,
+      u32 stride, struct rect r)
+{
+	u32 w = dw, h = dh;
+	pixman_box32_t box;
+	pixman_image_t *simg, *dimg;
+	pixman_transform_t tfrm;
+	pixman_f_transform_t ftfrm, otfrm;
+
+	if (TFORM_SWAPS(t)) {
+		w = dh;
+		h = dw;
+	}
+
+	orient(&otfrm, t, w, h);
+	box = to_buffer(&otfrm, r.x, r.y, (double)r.x + r.w, (double)r.y + r.h, w,
+	                h);
+	pixman_f_transform_init_translate(&ftfrm, -(double)r.x, -(double)r.y);
+	pixman_f_transform_multiply(&ftfrm, &ftfrm, &otfrm);
+	pixman_transform_from_pixman_f_transform(&tfrm, &ftfrm);
+
+	simg = pixman_image_create_bits(PIXMAN_x8r8g8b8, r.w, r.h, (u32 *)src,
+	                                stride * sizeof(xrgb));
+	pixman_image_set_filter(simg, PIXMAN_FILTER_NEAREST, NULL, 0);
+	pixman_image_set_transform(simg, &tfrm);
+	dimg = pixman_image_create_bits(fmt_pixman(fmt), dw, dh, (u32 *)dst,
+	                                dw * fmt_bpp(fmt));
+	if (fmt == WL_SHM_FORMAT_RGB565)
+		pixman_image_set_dither(dimg, PIXMAN_DITHER_ORDERED_BAYER_8);
+	pixman_image_composite32(PIXMAN_OP_SRC, simg, NULL, dimg, box.x1, box.y1,
+	                         0, 0, box.x1, box.y1, box.x2 - box.x1,
+	                         box.y2 - box.y1);
+	pixman_image_unref(simg);
+	pixman_image_unref(dimg);
+
+	return (struct rect){
+		.x = box.x1,
+		.y = box.y1,
+		.w = box.x2 - box.x1,
+		.h = box.y2 - box.y1,
+	};
+}
+
+/* Compose the on-screen rectangle ‘r’ of the ‘dw’×‘dh’ buffer ‘dst’ of the
+   wl_shm format ‘fmt’, shown on an output with the wl_output transform ‘t’,
+   from the buffer ‘base’ of the same size and format with the ‘n’ layers
+   ‘ov’ drawn over it, lowest first.  We return the rectangle of the buffer
+   that was drawn to, which differs from ‘r’ on rotated outputs. */
+struct rect
+compose(u8 *restrict dst, const u8 *restrict base, u32 dw, u32 dh, u32 fmt,
+        u32 t, const struct overlay *ov, size_t n, struct rect r)
+{
+	u32 w = dw, h = dh;
+	size_t bpp = fmt_bpp(fmt), stride = dw * bpp;
+	pixman_box32_t box, *oboxes;
+	pixman_image_t **simgs, *dimg;
+	pixman_transform_t tfrm;
+	pixman_f_transform_t ftfrm, otfrm;
+
+	if (TFORM_SWAPS(t)) {
+		w = dh;
+		h = dw;
+	}
+
+	orient(&otfrm, t, w, h);
+	box = to_buffer(&otfrm, r.x, r.y, (double)r.x + r.w, (double)r.y + r.h, w,
+	                h);
+
+	simgs = xcalloc(MAX(n, 1), sizeof(*simgs));
+	oboxes = xcalloc(MAX(n, 1), sizeof(*oboxes));
+	for (size_t i = 0; i < n; i++) {
+		const struct overlay *o = ov + i;
+
+		oboxes[i] = to_buffer(&otfrm, o->r.x, o->r.y,
+		                      (double)o->r.x + o->r.w,
+		                      (double)o->r.y + o->r.h, w, h);
+		if (!o->src) {
+			pixman_color_t c = {
+				.red = (o->color >> 16 & 0xFF) * 0x101,
+				.green = (o->color >> 8 & 0xFF) * 0x101,
+				.blue = (o->color & 0xFF) * 0x101,
+				.alpha = (o->color >> 24) * 0x101,
+			};
+			simgs[i] = pixman_image_create_solid_fill(&c);
+			continue;
+		}
+		pixman_f_transform_init_translate(&ftfrm, -(double)o->r.x,
+		                                  -(double)o->r.y);
+		pixman_f_transform_multiply(&ftfrm, &ftfrm, &otfrm);
+		pixman_transform_from_pixman_f_transform(&tfrm, &ftfrm);
+		simgs[i] = pixman_image_create_bits(PIXMAN_a8r8g8b8, o->r.w, o->r.h,
+		                                    (u32 *)o->src,
+		                                    o->stride * sizeof(xrgb));
+		pixman_image_set_filter(simgs[i], PIXMAN_FILTER_NEAREST, NULL, 0);
+		pixman_image_set_transform(simgs[i], &tfrm);
+	}
+	dimg = pixman_image_create_bits(fmt_pixman(fmt), dw, dh, (u32 *)dst,
+	                                stride);
+	if (fmt == WL_SHM_FORMAT_RGB565)
+		pixman_image_set_dither(dimg, PIXMAN_DITHER_ORDERED_BAYER_8);
+
+	for (i32 y1 = box.y1; y1 < box.y2; y1 += STRIP_ROWS) {
+		i32 y2 = MIN(y1 + STRIP_ROWS, box.y2);
+
+		for (i32 y = y1; y < y2; y++) {
+			memcpy(dst + y * stride + box.x1 * bpp,
+			       base + y * stride + box.x1 * bpp,
+			       (box.x2 - box.x1) * bpp);
+		}
+		for (size_t i = 0; i < n; i++) {
+			i32 x1 = MAX(box.x1, oboxes[i].x1);
+			i32 x2 = MIN(box.x2, oboxes[i].x2);
+			i32 oy1 = MAX(y1, oboxes[i].y1);
+			i32 oy2 = MIN(y2, oboxes[i].y2);
+
+			if (x1 < x2 && oy1 < oy2) {
+				pixman_image_composite32(PIXMAN_OP_OVER, simgs[i], NULL, dimg,
+				                         x1, oy1, 0, 0, x1, oy1, x2 - x1,
+				                         oy2 - oy1);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < n; i++)
+		pixman_image_unref(simgs[i]);
+	pixman_image_unref(dimg);
+	free(simgs);
+	free(oboxes);
+
+	return (struct rect){
+		.x = box.x1,
+		.y = box.y1,
+		.w = box.x2 - box.x1,
+		.h = box.y2 - box.y1,
+	};
+}
+
+/* Get the transform mapping the coordinates of a buffer of an output with
+   the wl_output transform ‘t’ to on-screen coordinates, where the buffer
+   appears as ‘w’×‘h’.  This is the inverse of weston_transformed_coord(). */
+void
+orient(pixman_f_transform_t *m, u32 t, u32 w, u32 h)
+{
+	pixman_f_transform_init_identity(m);
+	m->m[0][0] = m->m[1][1] = 0;
+	switch (t) {
+	case WL_OUTPUT_TRANSFORM_NORMAL:
+		m->m[0][0] = m->m[1][1] = 1;
+		break;
+	case WL_OUTPUT_TRANSFORM_90:
+		m->m[0][1] = -1;
+		m->m[0][2] = w;
+		m->m[1][0] = 1;
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		m->m[0][0] = -1;
+		m->m[0][2] = w;
+		m->m[1][1] = -1;
+		m->m[1][2] = h;
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		m->m[0][1] = 1;
+		m->m[1][0] = -1;
+		m->m[1][2] = h;
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+		m->m[0][0] = -1;
+		m->m[0][2] = w;
+		m->m[1][1] = 1;
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+		m->m[0][1] = 1;
+		m->m[1][0] = 1;
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+		m->m[0][0] = 1;
+		m->m[1][1] = -1;
+		m->m[1][2] = h;
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		m->m[0][1] = -1;
+		m->m[0][2] = w;
+		m->m[1][0] = -1;
+		m->m[1][2] = h;
+		break;
+	}
+}
+
+/* Get the box of the buffer of an output that covers the on-screen rectangle
+   from ‘x1’, ‘y1’ to ‘x2’, ‘y2’, clipped to the ‘w’×‘h’ screen.  The box is
+   mapped back to the buffer by the inverse of ‘otfrm’ from orient(), and
+   includes pixels it only partly covers. */
+pixman_box32_t
+to_buffer(const pixman_f_transform_t *otfrm, double x1, double y1, double x2,
+          double y2, u32 w, u32 h)
+{
+	pixman_f_transform_t inv;
+	pixman_f_vector_t a = {{MIN(MAX(x1, 0), w), MIN(MAX(y1, 0), h), 1}};
+	pixman_f_vector_t b = {{MIN(MAX(x2, 0), w), MIN(MAX(y2, 0), h), 1}};
+
+	pixman_f_transform_invert(&inv, otfrm);
+	pixman_f_transform_point(&inv, &a);
+	pixman_f_transform_point(&inv, &b);
+
+	/* Round outwards, bearing in mind that the coordinates are
+	   non-negative */
+	x1 = MIN(a.v[0], b.v[0]);
+	y1 = MIN(a.v[1], b.v[1]);
+	x2 = MAX(a.v[0], b.v[0]);
+	y2 = MAX(a.v[1], b.v[1]);
+	return (pixman_box32_t){
+		.x1 = x1,
+		.y1 = y1,
+		.x2 = (i32)x2 + ((i32)x2 < x2),
+		.y2 = (i32)y2 + ((i32)y2 < y2),
+	};
+}
+
+pixman_format_code_t
+fmt_pixman(u32 fmt)
+{
+	switch (fmt) {
+	case WL_SHM_FORMAT_RGB565:
+		return PIXMAN_r5g6b5;
+	case WL_SHM_FORMAT_XRGB2101010:
+		return PIXMAN_x2r10g10b10;
+	default:
+		return PIXMAN_x8r8g8b8;
+	}
+}
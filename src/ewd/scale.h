@@ -1,8 +1,53 @@
 #ifndef EWD_SCALE_H
 #define EWD_SCALE_H
 
+#include <stddef.h>
+
 #include "common.h"
 
-void scale(u8 *restrict, u32, u32, const u8 *restrict, u32, u32);
+/* Filters to scale with, from highest quality to cheapest */
+enum filter {
+	FILTER_BEST,
+	FILTER_BILINEAR,
+	FILTER_NEAREST,
+};
+
+/* Where an image goes in a buffer.  The whole image is scaled to the
+   rectangle ‘x’, ‘y’, ‘w’, ‘h’, given in fractions of the buffer as it
+   appears on screen, which may well reach past the edges of the buffer.  The
+   image is repeated all over the buffer if ‘tile’ is set, and otherwise
+   whatever it doesn’t cover is filled with ‘bg’. */
+struct place {
+	double x, y, w, h;
+	bool tile;
+	xrgb bg;
+};
+
+/* A rectangle of pixels */
+struct rect {
+	u32 x, y, w, h;
+};
+
+/* A layer drawn over an image: either the unscaled image ‘src’ in
+   premultiplied ARGB, with rows ‘stride’ pixels apart, or if that is NULL a
+   solid fill of the premultiplied ARGB colour ‘color’.  It covers the
+   on-screen rectangle ‘r’. */
+struct overlay {
+	struct rect r;
+	const u8 *src;
+	u32 stride;
+	u32 color;
+};
+
+/* Is the wl_output transform ‘t’ a quarter turn, swapping width and height? */
+#define TFORM_SWAPS(t) ((t) & 1)
+
+struct rect compose(u8 *restrict, const u8 *restrict, u32, u32, u32, u32,
+                    const struct overlay *, size_t, struct rect);
+size_t fmt_bpp(u32);
+struct rect patch(u8 *restrict, u32, u32, u32, u32, const u8 *restrict, u32,
+                  struct rect);
+void scale(u8 *restrict, u32, u32, u32, u32, const u8 *restrict, u32, u32,
+           const struct place *, enum filter);
 
 #endif /* !EWD_SCALE_H */
@@ -0,0 +1,45 @@
+#include <sys/param.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "common.h"
+#include "stats.h"
+
+static u32 hist_pct(const struct hist *, u32);
+
+void
+hist_add(struct hist *h, u64 x)
+{
+	h->b[MIN(x, HIST_LEN - 1)]++;
+	h->n++;
+}
+
+/* Write a histogram as a single line of the form ‘name label n=N p50=X p90=Y
+   p99=Z i:count...’ where only non-empty buckets are listed */
+void
+hist_print(int fd, const char *name, const char *label, const struct hist *h)
+{
+	dprintf(fd, "%s %s n=%" PRIu64 " p50=%" PRIu32 " p90=%" PRIu32
+	            " p99=%" PRIu32,
+	        name, label, h->n, hist_pct(h, 50), hist_pct(h, 90),
+	        hist_pct(h, 99));
+	for (size_t i = 0; i < HIST_LEN; i++) {
+		if (h->b[i])
+			dprintf(fd, " %zu:%" PRIu64, i, h->b[i]);
+	}
+	dprintf(fd, "\n");
+}
+
+/* Get the bucket containing the given percentile */
+u32
+hist_pct(const struct hist *h, u32 p)
+{
+	u64 acc = 0, want = (h->n * p + 99) / 100;
+
+	for (u32 i = 0; i < HIST_LEN; i++) {
+		if ((acc += h->b[i]) >= want && acc)
+			return i;
+	}
+	return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef EWD_STATS_H
+#define EWD_STATS_H
+
+#include "common.h"
+
+/* Number of buckets in a histogram.  Bucket ‘i’ counts the samples with the
+   value ‘i’, except for the last bucket which also counts every sample too
+   large to fit in any of the others. */
+#define HIST_LEN 64
+
+struct hist {
+	u64 n;           /* Total number of samples */
+	u64 b[HIST_LEN]; /* Buckets */
+};
+
+void hist_add(struct hist *, u64);
+void hist_print(int, const char *, const char *, const struct hist *);
+
+#endif /* !EWD_STATS_H */
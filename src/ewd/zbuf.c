@@ -0,0 +1,200 @@
+#include <sys/eventfd.h>
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "qoi.h"
+#include "zbuf.h"
+
+/* A single stripe to decompress */
+struct unz {
+	const u8 *src;
+	size_t len;
+	xrgb *dst;
+	size_t npx;
+	bool ok;
+	bool async; /* Decoded on a thread of its own? */
+	pthread_t thrd;
+};
+
+static void *unz_thrd(void *);
+static void *worker(void *);
+
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_t thrd;
+static bool running, quit;
+
+/* Jobs waiting to be compressed, in order, and the jobs that are done.  The
+   event FD is signalled whenever a job is done. */
+static struct zjob *todo, **todo_tail = &todo, *done;
+static int efd = -1;
+
+/* Compress the ‘w’×‘h’ image ‘src’.  This is fairly slow and is only meant to
+   be called from the background thread. */
+struct zbuf *
+zbuf_compress(const xrgb *src, u32 w, u32 h)
+{
+	struct zbuf *z = xcalloc(1, sizeof(*z));
+
+	z->w = w;
+	z->h = h;
+	for (size_t i = 0; i < ZBUF_STRIPES; i++) {
+		size_t y0 = (size_t)h * i / ZBUF_STRIPES;
+		size_t y1 = (size_t)h * (i + 1) / ZBUF_STRIPES;
+		size_t npx = (y1 - y0) * w;
+
+		if (npx == 0)
+			continue;
+		z->stripes[i].p = xmalloc(QOI_MAXLEN(npx));
+		z->stripes[i].len = qoi_encode(z->stripes[i].p, src + y0 * w, npx);
+		z->stripes[i].p = xrealloc(z->stripes[i].p, z->stripes[i].len);
+		z->size += z->stripes[i].len;
+	}
+	return z;
+}
+
+/* Decompress an image into ‘dst’, which must have room for all its pixels.
+   QOI can only be decoded one pixel after the other, so instead we decode
+   every stripe on its own thread. */
+bool
+zbuf_decompress(const struct zbuf *z, xrgb *dst)
+{
+	bool rv = true;
+	struct unz u[ZBUF_STRIPES];
+
+	for (size_t i = 0; i < ZBUF_STRIPES; i++) {
+		size_t y0 = (size_t)z->h * i / ZBUF_STRIPES;
+		size_t y1 = (size_t)z->h * (i + 1) / ZBUF_STRIPES;
+
+		u[i] = (struct unz){
+			.src = z->stripes[i].p,
+			.len = z->stripes[i].len,
+			.dst = dst + y0 * z->w,
+			.npx = (y1 - y0) * z->w,
+		};
+	}
+
+	/* Stripe 0 is ours; if a thread can’t be created its stripe is ours too */
+	for (size_t i = 1; i < ZBUF_STRIPES; i++) {
+		if ((errno = pthread_create(&u[i].thrd, NULL, unz_thrd, &u[i])))
+			warn("pthread_create");
+		else
+			u[i].async = true;
+	}
+	for (size_t i = 0; i < ZBUF_STRIPES; i++) {
+		if (!u[i].async)
+			unz_thrd(&u[i]);
+	}
+
+	for (size_t i = 0; i < ZBUF_STRIPES; i++) {
+		if (u[i].async && (errno = pthread_join(u[i].thrd, NULL)))
+			die("pthread_join");
+		rv = rv && u[i].ok;
+	}
+	return rv;
+}
+
+void
+zbuf_free(struct zbuf *z)
+{
+	if (!z)
+		return;
+	for (size_t i = 0; i < ZBUF_STRIPES; i++)
+		free(z->stripes[i].p);
+	free(z);
+}
+
+void *
+unz_thrd(void *arg)
+{
+	struct unz *u = arg;
+	u->ok = u->npx == 0 || qoi_decode(u->dst, u->npx, u->src, u->len);
+	return NULL;
+}
+
+/* Create the event FD signalled whenever a job is done.  The background
+   thread itself is only started once there is work for it, which avoids
+   starting it before the daemon forks. */
+int
+zjob_init(void)
+{
+	if ((efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+		die("eventfd");
+	return efd;
+}
+
+/* Queue an image to be compressed */
+void
+zjob_push(struct zjob *j)
+{
+	pthread_mutex_lock(&mtx);
+	if (!running) {
+		if ((errno = pthread_create(&thrd, NULL, worker, NULL)))
+			die("pthread_create");
+		running = true;
+	}
+	j->next = NULL;
+	*todo_tail = j;
+	todo_tail = &j->next;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mtx);
+}
+
+/* Take the list of jobs that are done, or NULL if there are none */
+struct zjob *
+zjob_done(void)
+{
+	eventfd_t n;
+	struct zjob *j;
+
+	(void)eventfd_read(efd, &n);
+	pthread_mutex_lock(&mtx);
+	j = done;
+	done = NULL;
+	pthread_mutex_unlock(&mtx);
+	return j;
+}
+
+/* Stop the background thread once it’s finished the job it’s on.  Jobs that
+   never got done are dropped on the floor. */
+void
+zjob_free(void)
+{
+	pthread_mutex_lock(&mtx);
+	quit = true;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mtx);
+	if (running && (errno = pthread_join(thrd, NULL)))
+		die("pthread_join");
+}
+
+void *
+worker(void *arg)
+{
+	struct zjob *j;
+
+	pthread_mutex_lock(&mtx);
+	for (;;) {
+		while (!todo && !quit)
+			pthread_cond_wait(&cond, &mtx);
+		if (quit)
+			break;
+		j = todo;
+		if (!(todo = j->next))
+			todo_tail = &todo;
+		pthread_mutex_unlock(&mtx);
+
+		j->z = zbuf_compress(j->src, j->w, j->h);
+
+		pthread_mutex_lock(&mtx);
+		j->next = done;
+		done = j;
+		(void)eventfd_write(efd, 1);
+	}
+	pthread_mutex_unlock(&mtx);
+	return NULL;
+}
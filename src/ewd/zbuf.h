@@ -0,0 +1,42 @@
+#ifndef EWD_ZBUF_H
+#define EWD_ZBUF_H
+
+#include <stddef.h>
+
+#include "common.h"
+
+/* Number of horizontal stripes an image is split into.  Each stripe is coded
+   on its own so that they can all be decompressed in parallel. */
+#define ZBUF_STRIPES 8
+
+/* A scaled image compressed with QOI, kept around in place of the image itself
+   while it isn’t being shown */
+struct zbuf {
+	u32 w, h;
+	size_t size; /* Compressed size of all stripes together (bytes) */
+	struct {
+		u8 *p;
+		size_t len;
+	} stripes[ZBUF_STRIPES];
+};
+
+/* A request to compress an image on the background thread.  The image must
+   stay valid and untouched until the job comes back out of zjob_done(). */
+struct zjob {
+	const xrgb *src;
+	u32 w, h;
+	void *data;        /* User data, untouched by the queue */
+	struct zbuf *z;    /* Compressed image */
+	struct zjob *next;
+};
+
+struct zbuf *zbuf_compress(const xrgb *, u32, u32);
+bool zbuf_decompress(const struct zbuf *, xrgb *);
+void zbuf_free(struct zbuf *);
+
+int zjob_init(void);
+struct zjob *zjob_done(void);
+void zjob_free(void);
+void zjob_push(struct zjob *);
+
+#endif /* !EWD_ZBUF_H */